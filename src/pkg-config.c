@@ -1,16 +1,21 @@
 // u-config: a small, simple, portable pkg-config clone
 // https://github.com/skeeto/u-config
-//   $ cc -nostartfiles -o pkg-config.exe pkg-config.c
+//   $ cc -nostartfiles -o pkg-config.exe pkg-config.c  (Windows)
+//   $ cc -o pkg-config pkg-config.c                     (POSIX)
 // This is free and unencumbered software released into the public domain.
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#  define _POSIX_C_SOURCE 200809L  // must precede every system header
+#endif
 #include <stddef.h>
 #define VERSION "0.34.0"
 
-typedef unsigned char    u8;
-typedef   signed int     b32;
-typedef   signed int     i32;
-typedef unsigned int     u32;
-typedef ptrdiff_t        iz;
-typedef          char    byte;
+typedef unsigned char      u8;
+typedef   signed int       b32;
+typedef   signed int       i32;
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef ptrdiff_t          iz;
+typedef          char      byte;
 
 #define assert(c)     while (!(c)) __builtin_unreachable()
 #define countof(a)    (iz)(sizeof(a) / sizeof(*(a)))
@@ -31,6 +36,14 @@ struct s8node {
     s8      str;
 };
 
+typedef struct pcfile pcfile;
+struct pcfile {
+    pcfile *next;
+    s8      name;
+    u64     size;
+    u64     mtime;  // zero if unknown
+};
+
 typedef struct {
     byte *beg;
     byte *end;
@@ -51,6 +64,7 @@ typedef struct {
     s8    sys_libpath;   // $PKG_CONFIG_SYSTEM_LIBRARY_PATH or default
     s8    print_sysinc;  // $PKG_CONFIG_ALLOW_SYSTEM_CFLAGS or empty
     s8    print_syslib;  // $PKG_CONFIG_ALLOW_SYSTEM_LIBS or empty
+    s8    cachedir;      // $PKG_CONFIG_CACHE_DIR or empty
     b32   define_prefix;
     b32   haslisting;
     u8    delim;
@@ -69,23 +83,50 @@ enum { filemap_OK, filemap_NOTFOUND, filemap_READERR };
 typedef struct {
     s8  data;
     i32 status;
+    b32 mapped;  // a view outside the arena, see os_unmapfile()
 } filemap;
 
 // Load a file into memory, maybe using the arena. The path must include
 // a null terminator since it may be passed directly to the OS interface.
-static filemap os_mapfile(os *, arena *, s8 path);
+// Only if allowed may the file be viewed in place rather than read into
+// the arena, in which case the view outlives the arena.
+static filemap os_mapfile(os *, arena *, s8 path, b32 mayview);
+
+// Release a view from os_mapfile(). Its data must not be used again.
+static void os_unmapfile(os *, s8 data);
 
-// List all .pc files under a particular path. The path must include a
+// List all .pc files under a particular path, with their sizes and
+// modification times when cheaply available. The path must include a
 // null terminator since it may be passed directly to the OS interface.
-static s8node *os_listing(os *, arena *, s8 path);
+static pcfile *os_listing(os *, arena *, s8 path);
+
+// Replace the contents of a file, atomically if possible, using the
+// arena for scratch. The path must include a null terminator. Failure
+// is reported but not fatal.
+static b32 os_writefile(os *, arena *, s8 path, s8 data);
 
 // Write buffer to stdout (1) or stderr (2). The platform must detect
 // write errors and arrange for an eventual non-zero exit status.
 static void os_write(os *, i32 fd, s8);
 
+// Read from standard input, returning the number of bytes read, or zero
+// at end of input or on error.
+static iz os_read(os *, u8 *buf, iz cap);
+
+// Call work(arg, i, perm) for each i in [0, n), possibly concurrently
+// from several threads, and return once all calls are complete. Each
+// thread has its own arena, reset at the start of every os_parallel()
+// call, so allocations remain valid until the next call. Work must not
+// call os_fail(). A platform may run all calls on the calling thread.
+static void os_parallel(os *, void (*work)(void *arg, iz i, arena *), void *arg, iz n);
+
 // Immediately exit the program with a non-zero status.
 static void os_fail(os *) __attribute((noreturn));
 
+// While armed with a __builtin_setjmp() buffer, os_fail() jumps to it
+// instead of exiting. A null buffer disarms it.
+static void os_trap(os *, void **jmp);
+
 
 // Application
 
@@ -356,6 +397,8 @@ typedef struct {
     u8    *buf;
     iz     cap;
     iz     len;
+    iz     flushed;  // memory buffers: length at the last flush()
+    b32    retry;    // memory buffers: fail quietly when full
     arena *perm;
     os    *ctx;
     i32    fd;
@@ -412,8 +455,13 @@ static void flush(u8buf *b)
 {
     switch (b->fd) {
     case -1: break;  // /dev/null
-    case  0: oom(b->ctx);
-             break;
+    case  0: if (b->len==b->cap && b->retry) {
+                 os_fail(b->ctx);  // the caller retries with more room
+             } else if (b->len == b->cap) {
+                 oom(b->ctx);
+             }
+             b->flushed = b->len;
+             return;  // memory buffers keep their contents
     default: if (b->len) {
                  os_write(b->ctx, b->fd, gets8(b));
              }
@@ -579,6 +627,7 @@ struct pkg {
     s8       realname;
     s8       contents;
     env     *env;
+    env     *memo;  // fully expanded variables, see expand()
     pkgspec *specs_requires;
     pkgspec *specs_requiresprivate;
     i32      flags;
@@ -975,6 +1024,7 @@ static void usage(u8buf *b)
     "u-config " VERSION " https://github.com/skeeto/u-config\n"
     "free and unencumbered software released into the public domain\n"
     "usage: pkg-config [OPTIONS...] [PACKAGES...]\n"
+    "  --batch (queries from stdin see .pc files as first read)\n"
     "  --cflags, --cflags-only-I, --cflags-only-other\n"
     "  --define-prefix, --dont-define-prefix\n"
     "  --define-variable=NAME=VALUE, --variable=NAME\n"
@@ -999,7 +1049,8 @@ static void usage(u8buf *b)
     "  PKG_CONFIG_SYSTEM_INCLUDE_PATH\n"
     "  PKG_CONFIG_SYSTEM_LIBRARY_PATH\n"
     "  PKG_CONFIG_ALLOW_SYSTEM_CFLAGS\n"
-    "  PKG_CONFIG_ALLOW_SYSTEM_LIBS\n";
+    "  PKG_CONFIG_ALLOW_SYSTEM_LIBS\n"
+    "  PKG_CONFIG_CACHE_DIR\n";
     prints8(b, S(usage));
 }
 
@@ -1019,9 +1070,58 @@ static void append(s8list *list, s8 str, arena *perm)
     list->tail = &node->next;
 }
 
+// The .pc files present in one search directory, listed once on first
+// use so that lookups need not probe every directory with a failed open.
+typedef struct pcname pcname;
+struct pcname {
+    pcname *child[4];
+    s8      name;  // without extension
+    u64     size;
+    u64     mtime;
+};
+
+typedef struct dirindex dirindex;
+struct dirindex {
+    dirindex *child[4];
+    s8        dir;
+    pcname   *names;
+};
+
+// Contents of previously-read .pc files, persisted between runs and
+// keyed by path. An entry is only trusted when its size and timestamp
+// match the directory listing.
+typedef struct cached cached;
+struct cached {
+    cached *child[4];
+    cached *next;
+    s8      path;
+    u64     size;
+    u64     mtime;
+    s8      contents;
+};
+
 typedef struct {
-    s8list list;
-    u8     delim;
+    cached *entries;
+    cached *head;
+    s8      path;  // null terminated, or null if not persisted
+    s8      view;  // loaded image, if viewed in place
+    b32     loaded;
+    b32     dirty;
+} cache;
+
+// Package lookup state that outlives a single query: directory indexes
+// and package contents, allocated from their own arena in batch mode.
+typedef struct {
+    dirindex *index;
+    cache    *cache;
+    arena    *perm;
+    b32       haslisting;
+} catalog;
+
+typedef struct {
+    s8list   list;
+    catalog *catalog;
+    u8       delim;
 } search;
 
 static search newsearch(u8 delim)
@@ -1057,6 +1157,148 @@ static void prependpath(search *dirs, s8 path, arena *perm)
     }
 }
 
+static u8 foldcase(u8 c)
+{
+    return c>='A' && c<='Z' ? c+'a'-'A' : c;
+}
+
+// Like s8hash() and s8equals(), but ignoring ASCII case the way Windows
+// file systems do when opening a .pc file. Elsewhere a case mismatch
+// merely costs a failed open.
+static u32 foldhash(s8 s)
+{
+    u32 h = 0x811c9dc5;
+    for (iz i = 0; i < s.len; i++) {
+        h ^= foldcase(s.s[i]);
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+static b32 foldequals(s8 a, s8 b)
+{
+    if (a.len != b.len) {
+        return 0;
+    }
+    for (iz i = 0; i < a.len; i++) {
+        if (foldcase(a.s[i]) != foldcase(b.s[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Find the name in the set. If an arena is given, insert it if missing.
+static pcname *pcnameset(pcname **m, s8 name, arena *perm)
+{
+    for (u32 h = foldhash(name); *m; h <<= 2) {
+        if (foldequals((*m)->name, name)) {
+            return *m;
+        }
+        m = &(*m)->child[h>>30];
+    }
+    if (perm) {
+        *m = new(perm, pcname, 1);
+        (*m)->name = name;
+    }
+    return *m;
+}
+
+static pcfile *listdir(s8 dir, arena *perm)
+{
+    u8buf buf = newmembuf(perm);
+    prints8(&buf, dir);
+    printu8(&buf, 0);
+    s8 pathz = finalize(&buf);
+    return os_listing(perm->ctx, perm, pathz);
+}
+
+static b32 ispcfile(s8 name)
+{
+    return name.len>3 && foldequals(taketail(name, 3), S(".pc"));
+}
+
+// Bytes needed by newdirindex() for this listing.
+static iz dirindexsize(s8 dir, pcfile *files)
+{
+    iz size = (iz)sizeof(dirindex) + dir.len + 64;
+    for (pcfile *file = files; file; file = file->next) {
+        if (ispcfile(file->name)) {
+            size += (iz)sizeof(pcname) + file->name.len + 8;
+        }
+    }
+    return size;
+}
+
+static dirindex *newdirindex(s8 dir, pcfile *files, arena *perm)
+{
+    dirindex *index = new(perm, dirindex, 1);
+    index->dir = news8(perm, dir.len);
+    s8copy(index->dir, dir);
+    for (pcfile *file = files; file; file = file->next) {
+        if (ispcfile(file->name)) {
+            s8 name = cuttail(file->name, 3);
+            s8 copy = news8(perm, name.len);
+            s8copy(copy, name);
+            pcname *n = pcnameset(&index->names, copy, perm);
+            n->size  = file->size;
+            n->mtime = file->mtime;
+        }
+    }
+    return index;
+}
+
+// Might the package be found in this search directory? Only plain file
+// names are answered from the directory index, which also fills in the
+// listing entry. Anything else, such as a name with path components,
+// must be probed directly.
+static b32 mayexist(search *dirs, s8 dir, s8 realname, pcname **entry, arena *perm)
+{
+    catalog *cat = dirs->catalog;
+    *entry = 0;
+    if (!cat->haslisting || !realname.len) {
+        return 1;
+    } else if (s8equals(realname, S("pkg-config"))) {
+        return 1;  // built in, see readpackage()
+    }
+    for (iz i = 0; i < realname.len; i++) {
+        u8 c = realname.s[i];
+        if (pathsep(c) || c>0x7f) {
+            return 1;
+        }
+    }
+
+    dirindex **m = &cat->index;
+    for (u32 h = s8hash(dir); *m; h <<= 2) {
+        if (s8equals((*m)->dir, dir)) {
+            break;
+        }
+        m = &(*m)->child[h>>30];
+    }
+
+    // List into the query's arena, then copy the index into a separate
+    // catalog arena only if all of it fits, so that running out of memory
+    // never leaves a partial index behind. When the catalog is full, the
+    // directory is listed again by each query that needs it.
+    dirindex *index = *m;
+    if (!index) {
+        arena *keep = cat->perm;
+        arena scratch = *perm;
+        pcfile *files = listdir(dir, &scratch);
+        if (keep!=perm && keep->end-keep->beg>=dirindexsize(dir, files)) {
+            index = *m = newdirindex(dir, files, keep);
+        } else {
+            index = newdirindex(dir, files, &scratch);
+            *perm = scratch;
+            if (keep == perm) {
+                *m = index;
+            }
+        }
+    }
+    *entry = pcnameset(&index->names, realname, 0);
+    return !!*entry;
+}
+
 static b32 realnameispath(s8 realname)
 {
     return realname.len>3 && s8equals(taketail(realname, 3), S(".pc"));
@@ -1089,7 +1331,7 @@ static s8 readpackage(u8buf *err, s8 path, s8 realname, arena *perm)
     }
 
     s8 null = {0};
-    filemap m = os_mapfile(perm->ctx, perm, path);
+    filemap m = os_mapfile(perm->ctx, perm, path, 1);
     switch (m.status) {
     case filemap_NOTFOUND:
         return null;
@@ -1110,68 +1352,368 @@ static s8 readpackage(u8buf *err, s8 path, s8 realname, arena *perm)
     assert(0);
 }
 
-static void expand(u8buf *out, u8buf *err, env *global, pkg *p, s8 str)
+static void printword(u8buf *b, u64 v)
 {
-    i32 top = 0;
-    s8 stack[128];
+    for (i32 i = 0; i < 8; i++) {
+        printu8(b, (u8)(v >> (i*8)));
+    }
+}
 
-    stack[top] = str;
-    while (top >= 0) {
-        s8 s = stack[top--];
-        for (iz i = 0; i < s.len-1; i++) {
-            if (s.s[i]=='$' && s.s[i+1]=='{') {
-                if (top >= countof(stack)-2) {
-                    prints8(err, S("pkg-config: "));
-                    prints8(err, S("exceeded max recursion depth in '"));
-                    prints8(err, p->path);
-                    prints8(err, S("'\n"));
-                    flush(err);
-                    os_fail(err->ctx);
-                }
+typedef struct {
+    s8  tail;
+    u64 value;
+    b32 ok;
+} word;
 
-                prints8(out, takehead(s, i));
-
-                iz beg = i + 2;
-                iz end = beg;
-                for (; end<s.len && s.s[end]!='}'; end++) {}
-                s8 name = s8span(s.s+beg, s.s+end);
-                end += end < s.len;
-
-                // If the tail is empty, this stack push could be elided
-                // as a kind of tail call optimization. However, there
-                // would need to be another mechanism in place to detect
-                // infinite recursion.
-                s8 tail = cuthead(s, end);
-                stack[++top] = tail;
-
-                s8 value = lookup(global, p->env, name);
-                if (!value.s) {
-                    prints8(err, S("pkg-config: "));
-                    prints8(err, S("undefined variable '"));
-                    prints8(err, name);
-                    prints8(err, S("' in '"));
-                    prints8(err, p->path);
-                    prints8(err, S("'\n"));
-                    flush(err);
-                    os_fail(err->ctx);
-                }
-                stack[++top] = value;
-                s.len = 0;
-                break;
+static word cutword(s8 s)
+{
+    word r = {0};
+    if (s.len < 8) {
+        return r;
+    }
+    for (i32 i = 0; i < 8; i++) {
+        r.value |= (u64)s.s[i] << (i*8);
+    }
+    r.tail = cuthead(s, 8);
+    r.ok = 1;
+    return r;
+}
 
-            } else if (s.s[i]=='$' && s.s[i+1]=='$') {
-                s8 head = takehead(s, i+1);
-                prints8(out, head);
-                stack[++top] = cuthead(s, i+2);
-                s.len = 0;
-                break;
+static s8 cachemagic(void)
+{
+    return S("u-config " VERSION " cache\n");
+}
+
+static cache *newcache(s8 dir, arena *perm)
+{
+    cache *c = new(perm, cache, 1);
+    if (!dir.len) {
+        return c;  // in-memory only
+    }
+    u8buf buf = newmembuf(perm);
+    prints8(&buf, dir);
+    prints8(&buf, S("/u-config.cache"));
+    printu8(&buf, 0);
+    c->path = finalize(&buf);
+    return c;
+}
+
+// Find the cache entry for a path. If an arena is given, create it if
+// missing, in which case the path must outlive the cache.
+static cached *findcached(cache *c, s8 path, arena *perm)
+{
+    cached **m = &c->entries;
+    for (u32 h = s8hash(path); *m; h <<= 2) {
+        if (s8equals((*m)->path, path)) {
+            return *m;
+        }
+        m = &(*m)->child[h>>30];
+    }
+    if (!perm) {
+        return 0;
+    }
+    *m = new(perm, cached, 1);
+    (*m)->path = path;
+    (*m)->next = c->head;
+    c->head = *m;
+    return *m;
+}
+
+// Load the cache image. Records are length-prefixed and refer into the
+// loaded data, so nothing is copied. A damaged image is ignored.
+static void loadcache(cache *c, arena *perm)
+{
+    c->loaded = 1;
+    if (!c->path.s) {
+        return;
+    }
+    arena rollback = *perm;
+    filemap m = os_mapfile(perm->ctx, perm, c->path, 1);
+    if (m.status == filemap_OK && m.mapped) {
+        c->view = m.data;
+    }
+    if (m.status!=filemap_OK || !startswith(m.data, cachemagic())) {
+        *perm = rollback;
+        return;
+    }
+
+    s8 data = cuthead(m.data, cachemagic().len);
+    while (data.len) {
+        word pathlen = cutword(data);
+        if (!pathlen.ok || pathlen.value>(u64)pathlen.tail.len) {
+            break;
+        }
+        s8 path = takehead(pathlen.tail, (iz)pathlen.value);
+        word size  = cutword(cuthead(pathlen.tail, path.len));
+        word mtime = size.ok ? cutword(size.tail) : size;
+        word len   = mtime.ok ? cutword(mtime.tail) : mtime;
+        if (!len.ok || len.value>(u64)len.tail.len) {
+            break;
+        }
+        if (perm->end-perm->beg < (iz)sizeof(cached)) {
+            break;  // too large to keep, so load none of it
+        }
+        cached *e = findcached(c, path, perm);
+        e->size = size.value;
+        e->mtime = mtime.value;
+        e->contents = takehead(len.tail, (iz)len.value);
+        data = cuthead(len.tail, e->contents.len);
+    }
+
+    if (data.len) {
+        *perm = rollback;
+        c->entries = c->head = 0;
+    }
+}
+
+// Does the listing of the entry's directory still show the file as it was
+// cached? Entries in directories not listed by this run are kept as-is.
+static b32 confirmed(catalog *cat, cached *e)
+{
+    iz cut = e->path.len;
+    for (; cut && e->path.s[cut-1]!='/'; cut--) {}
+    if (!cut || !realnameispath(cuthead(e->path, cut))) {
+        return 1;
+    }
+    s8 dir = takehead(e->path, cut-1);
+    s8 name = cuttail(cuthead(e->path, cut), 3);
+
+    dirindex *index = cat->index;
+    for (u32 h = s8hash(dir); index; h <<= 2) {
+        if (s8equals(index->dir, dir)) {
+            pcname *n = pcnameset(&index->names, name, 0);
+            return n && n->size==e->size && n->mtime==e->mtime;
+        }
+        index = index->child[h>>30];
+    }
+    return 1;
+}
+
+// Write back the cache image if any package was read from disk or any
+// cached file has since gone, dropping entries a listing contradicts.
+// A loaded image still viewed in place would block replacing the file on
+// some platforms, so it is released, after which the cache is unusable.
+static void savecache(catalog *cat, arena scratch)
+{
+    cache *c = cat->cache;
+    if (!c || !c->path.s) {
+        return;
+    }
+    b32 stale = 0;
+    for (cached *e = c->head; e; e = e->next) {
+        if (e->contents.s && !confirmed(cat, e)) {
+            e->contents.s = 0;
+            stale = 1;
+        }
+    }
+    if (!c->dirty && !stale) {
+        return;
+    }
+
+    u8buf buf = newmembuf(&scratch);
+    prints8(&buf, cachemagic());
+    for (cached *e = c->head; e; e = e->next) {
+        if (e->contents.s) {
+            printword(&buf, (u64)e->path.len);
+            prints8(&buf, e->path);
+            printword(&buf, e->size);
+            printword(&buf, e->mtime);
+            printword(&buf, (u64)e->contents.len);
+            prints8(&buf, e->contents);
+        }
+    }
+    s8 data = finalize(&buf);
+    if (c->view.s) {
+        os_unmapfile(scratch.ctx, c->view);
+        c->view.s = 0;
+        c->entries = c->head = 0;
+    }
+    if (os_writefile(scratch.ctx, &scratch, c->path, data)) {
+        c->dirty = 0;
+    } else {
+        u8buf *err = newfdbuf(&scratch, 2, 1<<7);
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("could not write cache '"));
+        prints8(err, cuttail(c->path, 1));
+        prints8(err, S("'\n"));
+        flush(err);
+    }
+}
+
+// Read a package, going through the cache when the directory listing
+// provided a timestamp to validate against. The in-memory cache of a
+// batch run does not need one, as listings are not repeated anyway.
+static s8 loadpackage(u8buf *err, search *dirs, s8 path, s8 realname, pcname *entry, arena *perm)
+{
+    catalog *cat = dirs->catalog;
+    cache *c = cat->cache;
+    if (!c || !entry || (!entry->mtime && c->path.s)) {
+        return readpackage(err, path, realname, perm);
+    }
+
+    arena *keep = cat->perm;
+    if (!c->loaded) {
+        loadcache(c, keep);
+    }
+    s8 key = cuttail(path, 1);
+    cached *e = findcached(c, key, 0);
+    if (e && e->size==entry->size && e->mtime==entry->mtime) {
+        return e->contents;
+    }
+
+    // Read into the catalog arena while holding back room for the cache
+    // entry. Once too little is left, read into the query's arena and do
+    // not cache, so that a full catalog only costs speed.
+    iz reserve = ((iz)sizeof(cached) + key.len + 64 + 7) & -8;
+    if (keep->end-keep->beg < 2*reserve) {
+        return readpackage(err, path, realname, perm);
+    }
+    arena trial = *keep;
+    trial.end -= reserve;
+    s8 contents = readpackage(err, path, realname, &trial);
+    keep->beg = trial.beg;
+    perm = keep;
+    if (contents.s && (!entry->mtime || (u64)contents.len==entry->size)) {
+        if (!e) {
+            s8 copy = news8(perm, key.len);
+            s8copy(copy, key);
+            e = findcached(c, copy, perm);
+        }
+        e->size = entry->size;
+        e->mtime = entry->mtime;
+        e->contents = contents;
+        c->dirty = 1;
+    }
+    return contents;
+}
+
+typedef struct {
+    s8  lit;   // literal text before the token
+    s8  name;
+    s8  tail;  // remaining input
+    b32 ref;   // name is a variable reference
+} exptoken;
+
+// Split off the literal text up to and including the next ${name}
+// reference or $$ escape.
+static exptoken exptokenize(s8 s)
+{
+    exptoken t = {0};
+    for (iz i = 0; i < s.len-1; i++) {
+        if (s.s[i]=='$' && s.s[i+1]=='{') {
+            iz beg = i + 2;
+            iz end = beg;
+            for (; end<s.len && s.s[end]!='}'; end++) {}
+            t.lit = takehead(s, i);
+            t.name = s8span(s.s+beg, s.s+end);
+            t.tail = cuthead(s, end + (end<s.len));
+            t.ref = 1;
+            return t;
+        } else if (s.s[i]=='$' && s.s[i+1]=='$') {
+            t.lit = takehead(s, i+1);
+            t.tail = cuthead(s, i+2);
+            return t;
+        }
+    }
+    t.lit = s;
+    return t;
+}
+
+typedef struct expansion expansion;
+struct expansion {
+    expansion *next;
+    s8        *memo;  // null for the string passed to expand()
+    s8         value;
+    s8         rest;  // not yet scanned for references
+};
+
+// Expand variable references in str. Each variable is expanded once
+// per package and memoized, so a chain like prefix, exec_prefix, libdir
+// is walked once rather than again in every field. A memo entry with
+// a null string and negative length is in progress, and meeting it
+// again means the variable refers to itself.
+static s8 expand(u8buf *err, env *global, pkg *p, s8 str, arena *perm)
+{
+    expansion *top = new(perm, expansion, 1);
+    top->value = top->rest = str;
+
+    for (;;) {
+        s8 *memo = 0;
+        s8  name = {0};
+        while (!memo && top->rest.len) {
+            exptoken t = exptokenize(top->rest);
+            top->rest = t.tail;
+            if (t.ref) {
+                name = t.name;
+                memo = insert(&p->memo, name, perm);
+                memo = memo->s ? 0 : memo;
+            }
+        }
+
+        if (memo) {
+            if (memo->len < 0) {
+                prints8(err, S("pkg-config: "));
+                prints8(err, S("exceeded max recursion depth in '"));
+                prints8(err, p->path);
+                prints8(err, S("'\n"));
+                flush(err);
+                os_fail(err->ctx);
+            }
+
+            s8 value = lookup(global, p->env, name);
+            if (!value.s) {
+                prints8(err, S("pkg-config: "));
+                prints8(err, S("undefined variable '"));
+                prints8(err, name);
+                prints8(err, S("' in '"));
+                prints8(err, p->path);
+                prints8(err, S("'\n"));
+                flush(err);
+                os_fail(err->ctx);
+            }
+
+            memo->len = -1;
+            expansion *e = new(perm, expansion, 1);
+            e->next = top;
+            e->memo = memo;
+            e->value = e->rest = value;
+            top = e;
+            continue;
+        }
+
+        // Every reference is now memoized, so assemble the result
+        u8buf buf = newmembuf(perm);
+        for (s8 s = top->value; s.len;) {
+            exptoken t = exptokenize(s);
+            prints8(&buf, t.lit);
+            if (t.ref) {
+                prints8(&buf, *insert(&p->memo, t.name, 0));
             }
+            s = t.tail;
+        }
+        s8 result = finalize(&buf);
+
+        if (!top->memo) {
+            return result;
+        }
+        *top->memo = result;
+        top = top->next;
+    }
+}
+
+// Does the string contain anything for expand() to substitute?
+static b32 expandable(s8 s)
+{
+    for (iz i = 0; i < s.len-1; i++) {
+        if (s.s[i]=='$' && (s.s[i+1]=='{' || s.s[i+1]=='$')) {
+            return 1;
         }
-        prints8(out, s);
     }
+    return 0;
 }
 
-// Merge and expand data from "update" into "base".
+// Merge and expand data from "update" into "base". Fields without
+// substitutions keep referring to the package contents.
 static void expandmerge(u8buf *err, env *g, pkg *base, pkg *update, arena *perm)
 {
     base->path = update->path;
@@ -1179,11 +1721,14 @@ static void expandmerge(u8buf *err, env *g, pkg *base, pkg *update, arena *perm)
     base->env = update->env;
     base->flags = update->flags;
     for (i32 i = 0; i < PKG_NFIELDS; i++) {
-        u8buf mem = newmembuf(perm);
         s8 src = *fieldbyid(update, i);
-        expand(&mem, err, g, update, src);
-        *fieldbyid(base, i) = finalize(&mem);
+        if (src.s && !expandable(src)) {
+            *fieldbyid(base, i) = src;
+            continue;
+        }
+        *fieldbyid(base, i) = expand(err, g, update, src, perm);
     }
+    base->memo = update->memo;
 
     base->specs_requires = parsespecs(
         &base->requires, 1, base, err, perm
@@ -1209,8 +1754,12 @@ static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
     }
 
     for (s8node *n = dirs->list.head; n && !contents.s; n = n->next) {
+        pcname *entry = 0;
+        if (!mayexist(dirs, n->str, realname, &entry, perm)) {
+            continue;
+        }
         path = buildpath(n->str, realname, perm);
-        contents = readpackage(err, path, realname, perm);
+        contents = loadpackage(err, dirs, path, realname, entry, perm);
         path = cuttail(path, 1);  // remove null terminator
     }
 
@@ -1435,12 +1984,25 @@ typedef struct {
     procstate stack[256];
 } processor;
 
-static processor *newprocessor(config *c, u8buf *err, env **g)
+// The catalog is allocated from, and keeps using, the given arena. The
+// in-memory cache is always kept when serving batch queries.
+static catalog *newcatalog(config *c, b32 batch, arena *perm)
+{
+    catalog *cat = new(perm, catalog, 1);
+    cat->perm = perm;
+    cat->haslisting = c->haslisting;
+    if (c->haslisting && (batch || c->cachedir.len)) {
+        cat->cache = newcache(c->cachedir, perm);
+    }
+    return cat;
+}
+
+static processor *newprocessor(config *c, catalog *cat, u8buf *err, env **g, arena *perm)
 {
-    arena *perm = &c->perm;
     processor *proc = new(perm, processor, 1);
     proc->err = err;
     proc->search = newsearch(c->delim);
+    proc->search.catalog = cat;
     appendpath(&proc->search, c->envpath, perm);
     appendpath(&proc->search, c->fixedpath, perm);
     proc->global = g;
@@ -1624,33 +2186,35 @@ static void msvcize(u8buf *out, s8 arg)
     }
 }
 
-typedef struct argpos argpos;
-struct argpos {
-    argpos *child[4];
-    argpos *next;
-    s8      arg;
-    iz      position;
-};
+typedef struct {
+    s8 arg;
+    iz position;
+} argpos;
 
 typedef struct {
     s8list  list;
-    argpos *positions;
+    s8list  excluded;
+    argpos *slots;  // see indexargs()
     iz      count;
+    iz      nexcluded;
+    i32     exp;
 } args;
 
-static argpos *findargpos(argpos **m, s8 arg, arena *perm)
+// Find the slot for the argument, which is empty if not yet present.
+// Open addressing with double hashing, the step taken from the high
+// hash bits, over a table sized never to fill.
+static argpos *findargpos(args *args, s8 arg)
 {
-    for (u32 h = s8hash(arg); *m; h <<= 2) {
-        if (s8equals((*m)->arg, arg)) {
-            return *m;
+    u32 h = s8hash(arg);
+    u32 mask = ((u32)1<<args->exp) - 1;
+    u32 step = h>>(32 - args->exp) | 1;
+    for (u32 i = h;;) {
+        i = (i + step) & mask;
+        argpos *slot = args->slots + i;
+        if (!slot->arg.s || s8equals(slot->arg, arg)) {
+            return slot;
         }
-        m = &(*m)->child[h>>30];
-    }
-    if (perm) {
-        *m = new(perm, argpos, 1);
-        (*m)->arg = arg;
     }
-    return *m;
 }
 
 static b32 dedupable(s8 arg)
@@ -1673,27 +2237,53 @@ static b32 dedupable(s8 arg)
 static void appendarg(args *args, s8 arg, arena *perm)
 {
     append(&args->list, arg, perm);
-    iz position = args->count++;
-    if (dedupable(arg)) {
-        argpos *n = findargpos(&args->positions, arg, perm);
-        if (!n->position || startswith(arg, S("-l"))) {
-            // Zero position reserved for null, so bias it by 1
-            n->position = 1 + position;
-        }
-    }
+    args->count++;
 }
 
 static void excludearg(args *args, s8 arg, arena *perm)
 {
-    argpos *n = findargpos(&args->positions, arg, perm);
-    n->position = -1;  // i.e. position before first argument
+    append(&args->excluded, arg, perm);
+    args->nexcluded++;
+}
+
+// Decide the position of each argument once all are known, so that
+// the table is sized to stay at most half full. An argument may appear
+// only at its position, and excluded arguments, positioned before the
+// first argument, never appear.
+static void indexargs(args *args, arena *perm)
+{
+    iz total = args->count + args->nexcluded;
+    args->exp = 2;
+    while ((iz)1<<args->exp < 2*total) {
+        args->exp++;
+    }
+    args->slots = new(perm, argpos, (iz)1<<args->exp);
+
+    for (s8node *n = args->excluded.head; n; n = n->next) {
+        argpos *slot = findargpos(args, n->str);
+        slot->arg = n->str;
+        slot->position = -1;
+    }
+
+    iz position = 0;
+    for (s8node *n = args->list.head; n; n = n->next) {
+        s8 arg = n->str;
+        position++;  // zero position reserved for empty, so bias it by 1
+        if (dedupable(arg)) {
+            argpos *slot = findargpos(args, arg);
+            slot->arg = arg;
+            if (!slot->position || startswith(arg, S("-l"))) {
+                slot->position = position;
+            }
+        }
+    }
 }
 
 // Is this the correct position for the given argument?
 static b32 inposition(args *args, s8 arg, iz position)
 {
-    argpos *n = findargpos(&args->positions, arg, 0);
-    return !n || n->position==position+1;
+    argpos *slot = findargpos(args, arg);
+    return !slot->arg.s || slot->position==position+1;
 }
 
 typedef struct {
@@ -1777,6 +2367,7 @@ static void appendfield(u8buf *err, fieldwriter *w, pkg *p, s8 field)
 
 static void writeargs(u8buf *out, fieldwriter *w)
 {
+    indexargs(&w->args, w->perm);
     iz position = 0;
     u8 delim = w->delim ? w->delim : ' ';
     for (s8node *n = w->args.list.head; n; n = n->next) {
@@ -1794,49 +2385,148 @@ static void writeargs(u8buf *out, fieldwriter *w)
     }
 }
 
-static void list(u8buf *out, u8buf *err, env *g, arena a, s8node *dirs, b32 all)
-{
-    for (s8node *dir = dirs; dir; dir = dir->next) {
-        arena scratch = a;
+enum { listed_RETRY, listed_OK, listed_SKIP };
 
-        u8buf buf = newmembuf(&scratch);
-        prints8(&buf, dir->str);
-        printu8(&buf, 0);
-        s8 pathz = finalize(&buf);
-        s8node *files = os_listing(a.ctx, &scratch, pathz);
+typedef struct {
+    s8  data;
+    i32 verdict;
+    b32 mapped;
+} listed;
 
-        for (s8node *file = files; file; file = file->next) {
-            arena temp = scratch;
+typedef struct {
+    s8       dir;
+    pcfile **files;
+    listed  *results;
+    b32      validate;
+} listjob;
 
-            s8 name = file->str;
-            if (name.len > 3) {
-                name = cuttail(name, 3);  // remove extension
-            }
-            s8 path = buildpath(dir->str, name, &temp);
+static s8 listedname(pcfile *file)
+{
+    s8 name = file->name;
+    if (name.len > 3) {
+        name = cuttail(name, 3);  // remove extension
+    }
+    return name;
+}
 
-            filemap m = os_mapfile(a.ctx, &temp, path);
-            if (m.status != filemap_OK) {
-                continue;
-            }
+// Load the i-th file of a listing job. When validating, also parse it,
+// keeping only the verdict. With a guard, as on a worker thread, cases
+// that might exhaust the arena are left for a retry without the guard,
+// where running out of memory may fail as usual. Only that retry may
+// view a file in place, as nothing would release a worker's views.
+static void loadlisted(listjob *job, iz i, arena *a, b32 guard)
+{
+    listed *r = job->results + i;
+    s8 name = listedname(job->files[i]);
 
-            parseresult r = parsepackage(m.data, &temp);
-            if (r.err != parse_OK) {
-                continue;
+    iz pathlen = job->dir.len + name.len + 5;
+    if (guard && a->end-a->beg < 4*pathlen+256) {
+        r->verdict = listed_RETRY;
+        return;
+    }
+
+    arena temp = *a;
+    arena *perm = job->validate ? &temp : a;
+    s8 path = buildpath(job->dir, name, perm);
+    filemap m = os_mapfile(perm->ctx, perm, path, !guard);
+    if (m.status != filemap_OK) {
+        b32 retry = guard && m.status==filemap_READERR;
+        r->verdict = retry ? listed_RETRY : listed_SKIP;
+        return;
+    }
+    r->data = m.data;
+    r->verdict = listed_OK;
+    r->mapped = m.mapped;
+
+    if (job->validate) {
+        // Parsing allocates at most one variable per two bytes of input
+        iz need = (m.data.len/2 + 1)*(iz)sizeof(env) + m.data.len + 1024;
+        if (guard && perm->end-perm->beg < need) {
+            r->verdict = listed_RETRY;
+            return;
+        }
+        parseresult p = parsepackage(m.data, perm);
+        r->verdict = p.err==parse_OK ? listed_OK : listed_SKIP;
+        if (m.mapped) {
+            os_unmapfile(perm->ctx, m.data);
+            r->mapped = 0;
+        }
+    }
+}
+
+static void listwork(void *job, iz i, arena *perm)
+{
+    loadlisted(job, i, perm, 1);
+}
+
+static void list(u8buf *out, u8buf *err, env *g, arena a, s8node *dirs, b32 all)
+{
+    enum { chunk = 256 };
+    pcfile **pending = new(&a, pcfile *, chunk);
+    listed  *results = new(&a, listed, chunk);
+
+    for (s8node *dir = dirs; dir; dir = dir->next) {
+        arena scratch = a;
+
+        u8buf buf = newmembuf(&scratch);
+        prints8(&buf, dir->str);
+        printu8(&buf, 0);
+        s8 pathz = finalize(&buf);
+        pcfile *files = os_listing(a.ctx, &scratch, pathz);
+
+        // Load files in parallel a chunk at a time, but parse, expand,
+        // and print them in order here, so that output and any expansion
+        // error are exactly those of a sequential listing. Names alone
+        // only need a verdict, which workers decide on their own.
+        while (files) {
+            iz n = 0;
+            for (; files && n<chunk; files = files->next) {
+                pending[n++] = files;
             }
+            listjob job = {0};
+            job.dir = dir->str;
+            job.files = pending;
+            job.results = results;
+            job.validate = !all;
+            os_parallel(a.ctx, listwork, &job, n);
+
+            for (iz i = 0; i < n; i++) {
+                arena temp = scratch;
+                listed *r = results + i;
+                if (r->verdict == listed_RETRY) {
+                    loadlisted(&job, i, &temp, 0);
+                }
+                if (r->verdict != listed_OK) {
+                    continue;
+                }
+
+                parseresult p = {0};
+                if (all) {
+                    p = parsepackage(r->data, &temp);
+                }
+
+                if (p.err == parse_OK) {
+                    s8 name = listedname(pending[i]);
+                    prints8(out, name);
+                    if (all) {
+                        // NOTE: pkgconf does not correctly format Unicode
+                        // names in this 30-column field, so we won't either.
+                        for (iz i = name.len; i < 30; i++) {
+                            printu8(out, ' ');
+                        }
+                        printu8(out, ' ');
+                        prints8(out, expand(err, g, &p.pkg, p.pkg.name, &temp));
+                        prints8(out, S(" - "));
+                        prints8(out, expand(err, g, &p.pkg, p.pkg.description, &temp));
+                    }
+                    printu8(out, '\n');
+                }
 
-            prints8(out, name);
-            if (all) {
-                // NOTE: pkgconf does not correctly format Unicode names
-                // in this 30-column field, so we won't either.
-                for (iz i = name.len; i < 30; i++) {
-                    printu8(out, ' ');
+                // Contents are finished with, so a view from a retry can go
+                if (r->mapped) {
+                    os_unmapfile(a.ctx, r->data);
                 }
-                printu8(out, ' ');
-                expand(out, err, g, &r.pkg, r.pkg.name);
-                prints8(out, S(" - "));
-                expand(out, err, g, &r.pkg, r.pkg.description);
             }
-            printu8(out, '\n');
         }
     }
 }
@@ -1856,16 +2546,14 @@ static i32 parseuint(s8 s, i32 hi)
     return v;
 }
 
-static void uconfig(config *conf)
+// Run one pkg-config command, as given by its arguments.
+static void query(config *conf, catalog *cat, u8buf *out, s8 *origargs, iz norigargs, arena *perm)
 {
-    arena *perm = &conf->perm;
-
     env *global = 0;
     filter filterc = filter_ANY;
     filter filterl = filter_ANY;
-    u8buf *out = newfdbuf(perm, 1, 1<<12);
     u8buf *err = newfdbuf(perm, 2, 1<<7);
-    processor *proc = newprocessor(conf, err, &global);
+    processor *proc = newprocessor(conf, cat, err, &global, perm);
     iz argcount = 0;
 
     b32 msvc = 0;
@@ -1899,15 +2587,10 @@ static void uconfig(config *conf)
     *insert(&global, S("pc_sysrootdir"), perm) = S("/");
     *insert(&global, S("pc_top_builddir"), perm) = top_builddir;
 
-    s8 *origargs = new(perm, s8, conf->nargs);
-    for (i32 i = 0; i < conf->nargs; i++) {
-        origargs[i] = s8fromcstr(conf->args[i]);
-    }
-
-    s8 *args = new(perm, s8, conf->nargs);
+    s8 *args = new(perm, s8, norigargs);
     iz nargs = 0;
 
-    for (options opts = newoptions(origargs, conf->nargs);;) {
+    for (options opts = newoptions(origargs, norigargs);;) {
         optresult r = nextoption(&opts);
         if (!r.ok) {
             break;
@@ -2149,7 +2832,7 @@ static void uconfig(config *conf)
             if (p->flags & pkg_DIRECT) {
                 s8 value = lookup(global, p->env, variable);
                 if (value.s) {
-                    expand(out, err, global, p, value);
+                    prints8(out, expand(err, global, p, value, perm));
                     prints8(out, S("\n"));
                 }
             }
@@ -2199,6 +2882,176 @@ static void uconfig(config *conf)
     flush(out);
 }
 
+typedef struct {
+    u8 *buf;
+    iz  cap;
+    iz  len;
+    iz  off;
+    os *ctx;
+} input;
+
+// Buffered input from os_read().
+static input *newinput(arena *perm, iz cap)
+{
+    input *in = new(perm, input, 1);
+    in->cap = cap;
+    in->buf = new(perm, u8, cap);
+    in->ctx = perm->ctx;
+    return in;
+}
+
+// Read the next line from standard input without its terminator,
+// returning a null string at the end of input.
+static s8 readline(input *in, arena *perm)
+{
+    b32 any = 0;
+    u8buf line = newmembuf(perm);
+    for (;;) {
+        if (in->off == in->len) {
+            in->off = 0;
+            in->len = os_read(in->ctx, in->buf, in->cap);
+            if (!in->len) {
+                break;
+            }
+        }
+        any = 1;
+        u8 c = in->buf[in->off++];
+        if (c == '\n') {
+            break;
+        }
+        printu8(&line, c);
+    }
+
+    s8 r = {0};
+    if (any) {
+        r = finalize(&line);
+        if (r.len && r.s[r.len-1]=='\r') {
+            r = cuttail(r, 1);
+        }
+    }
+    return r;
+}
+
+// Split a batch query line into arguments at white space, following the
+// given leading arguments.
+static s8 *splitline(s8 *lead, iz nlead, s8 line, iz *nargs, arena *perm)
+{
+    iz count = nlead;
+    for (iz i = 0; i < line.len; i++) {
+        count += !whitespace(line.s[i]) && (!i || whitespace(line.s[i-1]));
+    }
+
+    s8 *args = new(perm, s8, count);
+    for (iz i = 0; i < nlead; i++) {
+        args[i] = lead[i];
+    }
+    *nargs = nlead;
+    for (iz i = 0; i < line.len;) {
+        for (; i<line.len && whitespace(line.s[i]); i++) {}
+        iz beg = i;
+        for (; i<line.len && !whitespace(line.s[i]); i++) {}
+        if (i > beg) {
+            args[(*nargs)++] = s8span(line.s+beg, line.s+i);
+        }
+    }
+    return args;
+}
+
+// Run one batch query, returning its exit status. A failing query
+// unwinds back here through os_trap() instead of exiting. Output is held
+// at the top of the arena, so that it can grow while the query allocates
+// below it. Should the output fill its part, the query is run again with
+// the split moved down, since queries do not depend on earlier attempts,
+// until the query's own part gets too small. A failed query releases only
+// what it explicitly flushed, such as --errors-to-stdout messages, like a
+// process that exits.
+static i32 batchquery(config *conf, catalog *cat, u8buf *out, s8 *args, iz nargs, arena scratch)
+{
+    iz total = scratch.end - scratch.beg;
+    for (iz room = total - total/4;; room /= 2) {
+        arena run = scratch;
+        run.end -= (total - room + 7) & -8;  // keep the split aligned
+        arena outspace = scratch;
+        outspace.beg = run.end;
+        u8buf held = newmembuf(&outspace);
+        held.retry = room/2 >= total/16;
+
+        void *jmp[5];
+        if (__builtin_setjmp(jmp)) {
+            os_trap(scratch.ctx, 0);
+            if (held.retry && held.len==held.cap) {
+                continue;
+            }
+            prints8(out, takehead(gets8(&held), held.flushed));
+            return 1;
+        }
+        os_trap(scratch.ctx, jmp);
+        query(conf, cat, &held, args, nargs, &run);
+        os_trap(scratch.ctx, 0);
+        prints8(out, gets8(&held));
+        return 0;
+    }
+}
+
+static void uconfig(config *conf)
+{
+    arena *perm = &conf->perm;
+
+    b32 batch = 0;
+    b32 dashdash = 0;
+    s8 *args = new(perm, s8, conf->nargs);
+    iz nargs = 0;
+    for (i32 i = 0; i < conf->nargs; i++) {
+        s8 arg = s8fromcstr(conf->args[i]);
+        if (!dashdash && s8equals(arg, S("--batch"))) {
+            batch = 1;
+        } else {
+            dashdash |= s8equals(arg, S("--"));
+            args[nargs++] = arg;
+        }
+    }
+
+    if (!batch) {
+        catalog *cat = newcatalog(conf, 0, perm);
+        u8buf *out = newfdbuf(perm, 1, 1<<12);
+        query(conf, cat, out, args, nargs, perm);
+        savecache(cat, *perm);
+        return;
+    }
+
+    // Each line of standard input is a query whose arguments follow the
+    // command line arguments. Each result is the query's standard output
+    // terminated by a null byte, then its exit status and a newline.
+    // Package lookups stay warm between queries in their own half of the
+    // arena, and the other half is reset for each query. Kept listings and
+    // .pc contents are never revisited, so queries answer from a snapshot
+    // and miss changes to search directories made during the batch.
+    arena keep = *perm;
+    keep.beg = keep.end - ((keep.end - keep.beg)/2 & -8);
+    perm->end = keep.beg;
+
+    catalog *cat = newcatalog(conf, 1, &keep);
+    u8buf *out = newfdbuf(&keep, 1, 1<<12);
+    input *in = newinput(&keep, 1<<12);
+    for (;;) {
+        arena scratch = *perm;
+        s8 line = readline(in, &scratch);
+        if (!line.s) {
+            break;
+        }
+        iz nqargs = 0;
+        s8 *qargs = splitline(args, nargs, line, &nqargs, &scratch);
+        i32 status = batchquery(conf, cat, out, qargs, nqargs, scratch);
+        printu8(out, 0);
+        printu8(out, (u8)('0' + status));
+        printu8(out, '\n');
+        flush(out);
+    }
+    savecache(cat, *perm);
+}
+
+#if defined(_WIN32)
+
 // Win32 types, constants, and declarations (replaces windows.h)
 // This is free and unencumbered software released into the public domain.
 
@@ -2208,21 +3061,34 @@ typedef unsigned short  char16_t;
 typedef char16_t        c16;
 
 enum {
+    ALL_PROCESSOR_GROUPS = 0xffff,
+
+    CREATE_ALWAYS = 2,
+
     FILE_ATTRIBUTE_NORMAL = 0x80,
 
     FILE_SHARE_ALL = 7,
 
-    GENERIC_READ = (i32)0x80000000,
+    GENERIC_READ  = (i32)0x80000000,
+    GENERIC_WRITE = 0x40000000,
+
+    INFINITE = -1,
 
     INVALID_HANDLE_VALUE = -1,
 
     MEM_COMMIT  = 0x1000,
     MEM_RESERVE = 0x2000,
 
+    MOVEFILE_REPLACE_EXISTING = 1,
+
     OPEN_EXISTING = 3,
 
+    FILE_MAP_READ = 4,
+
+    PAGE_READONLY  = 2,
     PAGE_READWRITE = 4,
 
+    STD_INPUT_HANDLE  = -10,
     STD_OUTPUT_HANDLE = -11,
     STD_ERROR_HANDLE  = -12,
 };
@@ -2240,17 +3106,27 @@ typedef struct {
 #define W32(r) __declspec(dllimport) r __stdcall
 W32(b32)    CloseHandle(iptr);
 W32(i32)    CreateFileW(c16 *, i32, i32, uptr, i32, i32, i32);
+W32(iptr)   CreateFileMappingW(iptr, uptr, i32, i32, i32, c16 *);
+W32(iptr)   CreateThread(uptr, iz, u32 (__stdcall *)(void *), void *, i32, u32 *);
+W32(b32)    DeleteFileW(c16 *);
 W32(void)   ExitProcess(i32);
 W32(b32)    FindClose(iptr);
 W32(iptr)   FindFirstFileW(c16 *, finddata *);
 W32(b32)    FindNextFileW(iptr, finddata *);
+W32(i32)    GetActiveProcessorCount(i32);
 W32(c16 *)  GetCommandLineW(void);
 W32(b32)    GetConsoleMode(iptr, i32 *);
+W32(u32)    GetCurrentProcessId(void);
 W32(i32)    GetEnvironmentVariableW(c16 *, c16 *, i32);
+W32(b32)    GetFileSizeEx(iptr, u64 *);
 W32(i32)    GetModuleFileNameW(iptr, c16 *, i32);
 W32(iptr)   GetStdHandle(i32);
+W32(byte *) MapViewOfFile(iptr, i32, i32, i32, uptr);
+W32(b32)    MoveFileExW(c16 *, c16 *, i32);
 W32(b32)    ReadFile(iptr, u8 *, i32, i32 *, uptr);
+W32(b32)    UnmapViewOfFile(void *);
 W32(byte *) VirtualAlloc(uptr, iz, i32, i32);
+W32(i32)    WaitForMultipleObjects(i32, iptr *, b32, i32);
 W32(b32)    WriteConsoleW(iptr, c16 *, i32, i32 *, uptr);
 W32(b32)    WriteFile(iptr, u8 *, i32, i32 *, uptr);
 
@@ -2388,13 +3264,27 @@ static i32 cmdline_to_argv8(c16 *cmd, u8 **argv)
 #  define PKG_CONFIG_PREFIX
 #endif
 
-// For communication with os_write()
+typedef struct {
+    arena  base;
+    arena  perm;
+    void (*work)(void *, iz, arena *);
+    void  *arg;
+    iz     n;
+    iz    *next;
+} worker;
+
+enum { MAX_WORKERS = 16 };
+
+// For communication with os_read(), os_write(), os_fail(), and
+// os_parallel()
 struct os {
     struct {
         iptr h;
         b32  isconsole;
         b32  err;
     } handles[3];
+    void **trap;
+    worker workers[MAX_WORKERS];
 };
 
 typedef struct {
@@ -2696,6 +3586,7 @@ void mainCRTStartup(void)
 {
     os ctx[1] = {0};
     i32 dummy;
+    ctx->handles[0].h         = GetStdHandle(STD_INPUT_HANDLE);
     ctx->handles[1].h         = GetStdHandle(STD_OUTPUT_HANDLE);
     ctx->handles[1].isconsole = GetConsoleMode(ctx->handles[1].h, &dummy);
     ctx->handles[2].h         = GetStdHandle(STD_ERROR_HANDLE);
@@ -2727,18 +3618,20 @@ void mainCRTStartup(void)
     conf->sys_libpath  = conf->pc_syslibpath;
     conf->print_sysinc = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_CFLAGS");
     conf->print_syslib = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_LIBS");
+    conf->cachedir     = fromenv_(perm, L"PKG_CONFIG_CACHE_DIR");
 
     // Reduce backslash occurrences in outputs
     normalize_(conf->envpath);
     normalize_(conf->fixedpath);
     normalize_(conf->top_builddir);
+    normalize_(conf->cachedir);
 
     uconfig(conf);
     ExitProcess(ctx->handles[1].err || ctx->handles[2].err);
     assert(0);
 }
 
-static filemap os_mapfile(os *ctx, arena *perm, s8 path)
+static filemap os_mapfile(os *ctx, arena *perm, s8 path, b32 mayview)
 {
     assert(ctx);
     assert(path.len > 0);
@@ -2765,8 +3658,41 @@ static filemap os_mapfile(os *ctx, arena *perm, s8 path)
         }
     }
 
-    r.data.s = (u8 *)perm->beg;
+    u64 size = 0;
     iz cap = perm->end - perm->beg;
+    if (!GetFileSizeEx(handle, &size)) {
+        CloseHandle(handle);
+        r.status = filemap_READERR;
+        return r;
+    }
+
+    // Small files are cheaper to read into the arena than to map, and
+    // empty files cannot be mapped at all. Larger files, and those that
+    // would not fit in the arena, are viewed in place, read-only.
+    if (!mayview && size>=(u64)cap) {
+        CloseHandle(handle);
+        r.status = filemap_READERR;
+        return r;
+    } else if (mayview && (size>=1<<16 || size>=(u64)cap)) {
+        iptr map = CreateFileMappingW(handle, 0, PAGE_READONLY, 0, 0, 0);
+        CloseHandle(handle);
+        byte *view = 0;
+        if (map) {
+            view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(map);  // the view keeps the mapping alive
+        }
+        if (!view || size>(uptr)-1>>1) {
+            r.status = filemap_READERR;
+            return r;
+        }
+        r.data.s = (u8 *)view;
+        r.data.len = (iz)size;
+        r.status = filemap_OK;
+        r.mapped = 1;
+        return r;
+    }
+
+    r.data.s = (u8 *)perm->beg;
     while (r.data.len < cap) {
         i32 len = truncsize(cap - r.data.len);
         ReadFile(handle, r.data.s+r.data.len, len, &len, 0);
@@ -2778,7 +3704,7 @@ static filemap os_mapfile(os *ctx, arena *perm, s8 path)
     CloseHandle(handle);
 
     if (r.data.len == cap) {
-        // If it filled all available space, assume the file is too large.
+        // The file grew while reading and filled all available space.
         r.status = filemap_READERR;
         return r;
     }
@@ -2788,7 +3714,13 @@ static filemap os_mapfile(os *ctx, arena *perm, s8 path)
     return r;
 }
 
-static s8node *os_listing(os *ctx, arena *a, s8 path)
+static void os_unmapfile(os *ctx, s8 data)
+{
+    assert(ctx);
+    UnmapViewOfFile(data.s);
+}
+
+static pcfile *os_listing(os *ctx, arena *a, s8 path)
 {
     assert(ctx);
     assert(path.len > 0);
@@ -2810,25 +3742,145 @@ static s8node *os_listing(os *ctx, arena *a, s8 path)
         }
     }
 
-    s8list files = {0};
+    pcfile  *head = 0;
+    pcfile **tail = &head;
     do {
         s16 name = {0};
         name.s = fd.name;
         for (; name.s[name.len]; name.len++) {}
-        append(&files, fromwide_(a, name), a);
+        pcfile *file = new(a, pcfile, 1);
+        file->name  = fromwide_(a, name);
+        file->size  = (u64)fd.size[0]<<32 | fd.size[1];
+        file->mtime = (u64)fd.write[1]<<32 | fd.write[0];
+        *tail = file;
+        tail = &file->next;
     } while (FindNextFileW(handle, &fd));
 
     FindClose(handle);
-    return files.head;
+    return head;
+}
+
+static b32 os_writefile(os *ctx, arena *a, s8 path, s8 data)
+{
+    assert(ctx);
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    // Write to a unique temporary beside the target, then rename it over
+    // the target so that concurrent readers never see a partial file.
+    arena scratch = *a;
+    u8buf buf = newmembuf(&scratch);
+    prints8(&buf, cuttail(path, 1));
+    printu8(&buf, '.');
+    for (u32 pid = GetCurrentProcessId(); pid; pid >>= 4) {
+        printu8(&buf, "0123456789abcdef"[pid&15]);
+    }
+    prints8(&buf, S(".tmp\0"));
+    s16 wtmp  = towide_(&scratch, finalize(&buf));
+    s16 wpath = towide_(&scratch, path);
+
+    i32 handle = CreateFileW(
+        wtmp.s,
+        GENERIC_WRITE,
+        0,
+        0,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        0
+    );
+    if (handle == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    b32 ok = 1;
+    for (iz off = 0; ok && off<data.len;) {
+        i32 len = truncsize(data.len - off);
+        ok = WriteFile(handle, data.s+off, len, &len, 0) && len>0;
+        off += len;
+    }
+    CloseHandle(handle);
+
+    ok = ok && MoveFileExW(wtmp.s, wpath.s, MOVEFILE_REPLACE_EXISTING);
+    if (!ok) {
+        DeleteFileW(wtmp.s);
+    }
+    return ok;
+}
+
+static iz os_read(os *ctx, u8 *buf, iz cap)
+{
+    i32 len = 0;
+    ReadFile(ctx->handles[0].h, buf, truncsize(cap), &len, 0);
+    return len;
 }
 
 static void os_fail(os *ctx)
 {
     assert(ctx);
+    if (ctx->trap) {
+        __builtin_longjmp(ctx->trap, 1);
+    }
     ExitProcess(1);
     assert(0);
 }
 
+static void os_trap(os *ctx, void **jmp)
+{
+    ctx->trap = jmp;
+}
+
+__attribute((force_align_arg_pointer))
+static u32 __stdcall workermain_(void *arg)
+{
+    worker *w = arg;
+    for (;;) {
+        iz i = __atomic_fetch_add(w->next, 1, __ATOMIC_RELAXED);
+        if (i >= w->n) {
+            return 0;
+        }
+        w->work(w->arg, i, &w->perm);
+    }
+}
+
+static void os_parallel(os *ctx, void (*work)(void *, iz, arena *), void *arg, iz n)
+{
+    i32 count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    count = count<MAX_WORKERS ? count : MAX_WORKERS;
+    count = count<n ? count : (i32)n;
+
+    iz next = 0;
+    for (i32 i = 0; i < count; i++) {
+        worker *w = ctx->workers + i;
+        if (!w->base.beg) {
+            w->base = newarena_(1<<22);
+            w->base.ctx = ctx;
+        }
+        w->perm = w->base;
+        w->work = work;
+        w->arg  = arg;
+        w->n    = n;
+        w->next = &next;
+    }
+
+    // The calling thread is the first worker. If a thread cannot be
+    // created, the remaining workers pick up its share.
+    i32 nthreads = 0;
+    iptr threads[MAX_WORKERS];
+    for (i32 i = 1; i < count; i++) {
+        threads[nthreads] = CreateThread(0, 0, workermain_, ctx->workers+i, 0, 0);
+        nthreads += !!threads[nthreads];
+    }
+    if (count) {
+        workermain_(ctx->workers);
+    }
+    if (nthreads) {
+        WaitForMultipleObjects(nthreads, threads, 1, INFINITE);
+    }
+    for (i32 i = 0; i < nthreads; i++) {
+        CloseHandle(threads[i]);
+    }
+}
+
 typedef struct {
     c16  buf[1<<8];
     iptr handle;
@@ -2894,3 +3946,482 @@ static void os_write(os *ctx, i32 fd, s8 s)
         *err = !WriteFile(handle, s.s, (i32)s.len, &dummy, 0);
     }
 }
+
+#else  // POSIX
+
+// POSIX platform layer for u-config
+// $ cc -o pkg-config pkg-config.c
+// This is free and unencumbered software released into the public domain.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Defaults may be set at build time, e.g. -DPKG_CONFIG_PREFIX=\"/opt\"
+// or -DPKG_CONFIG_MULTIARCH=\"$(cc -print-multiarch)\", or each path in
+// full. Multiarch directories are searched before the generic ones, as
+// Debian does, and are guessed for common glibc targets.
+#ifndef PKG_CONFIG_PREFIX
+#  define PKG_CONFIG_PREFIX "/usr"
+#endif
+#if !defined(PKG_CONFIG_MULTIARCH) && defined(__linux__) && defined(__GLIBC__)
+#  if defined(__x86_64__) && defined(__LP64__)
+#    define PKG_CONFIG_MULTIARCH "x86_64-linux-gnu"
+#  elif defined(__i386__)
+#    define PKG_CONFIG_MULTIARCH "i386-linux-gnu"
+#  elif defined(__aarch64__) && defined(__LP64__)
+#    define PKG_CONFIG_MULTIARCH "aarch64-linux-gnu"
+#  endif
+#endif
+#ifdef PKG_CONFIG_MULTIARCH
+#  define PKG_CONFIG_MULTIARCH_LIB_ PKG_CONFIG_PREFIX "/lib/" PKG_CONFIG_MULTIARCH
+#  define PKG_CONFIG_MULTIARCH_PC_ PKG_CONFIG_MULTIARCH_LIB_ "/pkgconfig:"
+#  define PKG_CONFIG_MULTIARCH_SYS_ PKG_CONFIG_MULTIARCH_LIB_ ":"
+#else
+#  define PKG_CONFIG_MULTIARCH_PC_
+#  define PKG_CONFIG_MULTIARCH_SYS_
+#endif
+#ifndef PKG_CONFIG_LIBDIR
+#  define PKG_CONFIG_LIBDIR \
+     PKG_CONFIG_MULTIARCH_PC_ \
+     PKG_CONFIG_PREFIX "/lib/pkgconfig:" \
+     PKG_CONFIG_PREFIX "/share/pkgconfig"
+#endif
+#ifndef PKG_CONFIG_SYSTEM_INCLUDE_PATH
+#  define PKG_CONFIG_SYSTEM_INCLUDE_PATH PKG_CONFIG_PREFIX "/include"
+#endif
+#ifndef PKG_CONFIG_SYSTEM_LIBRARY_PATH
+#  define PKG_CONFIG_SYSTEM_LIBRARY_PATH \
+     PKG_CONFIG_MULTIARCH_SYS_ PKG_CONFIG_PREFIX "/lib"
+#endif
+
+// For communication with os_write(), os_fail(), and os_parallel()
+struct os {
+    void **trap;
+    arena  scratch;
+    b32    err[3];
+    b32    quiet;  // discard standard output, for benchmarking
+};
+
+static arena newarena_(iz cap)
+{
+    arena arena = {0};
+    arena.beg = malloc(cap);
+    if (!arena.beg) {
+        arena.beg = (byte *)16;  // aligned, non-null, zero-size arena
+        cap = 0;
+    }
+    arena.end = arena.beg + cap;
+    return arena;
+}
+
+static s8 fromenv_(char *name)
+{
+    return s8fromcstr((u8 *)getenv(name));
+}
+
+static config *newconfig_(os *ctx, iz cap)
+{
+    arena perm = newarena_(cap);
+    perm.ctx = ctx;
+    config *conf = new(&perm, config, 1);
+    conf->perm = perm;
+    conf->haslisting = 1;
+    conf->delim = ':';
+    conf->define_prefix = 0;  // packages are not relocated, as in pkgconf
+
+    conf->pc_path = S(PKG_CONFIG_LIBDIR);
+    conf->pc_sysincpath = S(PKG_CONFIG_SYSTEM_INCLUDE_PATH);
+    conf->pc_syslibpath = S(PKG_CONFIG_SYSTEM_LIBRARY_PATH);
+    conf->envpath = fromenv_("PKG_CONFIG_PATH");
+    conf->fixedpath = fromenv_("PKG_CONFIG_LIBDIR");
+    if (!conf->fixedpath.s) {
+        conf->fixedpath = conf->pc_path;
+    }
+    conf->top_builddir = fromenv_("PKG_CONFIG_TOP_BUILD_DIR");
+    conf->sys_incpath  = fromenv_("PKG_CONFIG_SYSTEM_INCLUDE_PATH");
+    if (!conf->sys_incpath.s) {
+        conf->sys_incpath = conf->pc_sysincpath;
+    }
+    conf->sys_libpath  = fromenv_("PKG_CONFIG_SYSTEM_LIBRARY_PATH");
+    if (!conf->sys_libpath.s) {
+        conf->sys_libpath = conf->pc_syslibpath;
+    }
+    conf->print_sysinc = fromenv_("PKG_CONFIG_ALLOW_SYSTEM_CFLAGS");
+    conf->print_syslib = fromenv_("PKG_CONFIG_ALLOW_SYSTEM_LIBS");
+    conf->cachedir     = fromenv_("PKG_CONFIG_CACHE_DIR");
+    return conf;
+}
+
+#ifndef BENCH
+int main(int argc, char **argv)
+{
+    os ctx[1] = {0};
+    config *conf = newconfig_(ctx, 1<<22);
+    conf->args  = (u8 **)argv + !!argc;
+    conf->nargs = argc - !!argc;
+    uconfig(conf);
+    return ctx->err[1] || ctx->err[2];
+}
+#endif
+
+static filemap os_mapfile(os *ctx, arena *perm, s8 path, b32 mayview)
+{
+    assert(ctx);
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    filemap r = {0};
+    int fd = open((char *)path.s, O_RDONLY);
+    struct stat st;
+    if (fd!=-1 && (fstat(fd, &st) || S_ISDIR(st.st_mode))) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd == -1) {
+        r.status = filemap_NOTFOUND;
+        return r;
+    }
+
+    // Mapping only pays off for large files, or those that would not fit
+    // in the arena. Small files, and anything that cannot be mapped, are
+    // read into the arena.
+    iz cap = perm->end - perm->beg;
+    b32 large = st.st_size>=1<<16 || st.st_size>=cap;
+    if (mayview && S_ISREG(st.st_mode) && large && (size_t)st.st_size<=(size_t)-1>>1) {
+        void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            r.data.s = p;
+            r.data.len = (iz)st.st_size;
+            r.status = filemap_OK;
+            r.mapped = 1;
+            return r;
+        }
+    }
+
+    r.data.s = (u8 *)perm->beg;
+    while (r.data.len < cap) {
+        iz len = read(fd, r.data.s+r.data.len, cap-r.data.len);
+        if (len==-1 && errno==EINTR) {
+            continue;
+        } else if (len < 1) {
+            break;
+        }
+        r.data.len += len;
+    }
+    close(fd);
+
+    if (r.data.len == cap) {
+        // If it filled all available space, assume the file is too large.
+        r.status = filemap_READERR;
+        return r;
+    }
+
+    perm->beg += r.data.len;
+    r.status = filemap_OK;
+    return r;
+}
+
+// Sizes and timestamps would cost a stat() per entry, so they are left
+// unknown, which leaves the persistent package cache unused.
+static void os_unmapfile(os *ctx, s8 data)
+{
+    assert(ctx);
+    munmap(data.s, (size_t)data.len);
+}
+
+static pcfile *os_listing(os *ctx, arena *a, s8 path)
+{
+    assert(ctx);
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    DIR *dir = opendir((char *)path.s);
+    if (!dir) {
+        return 0;
+    }
+
+    pcfile  *head = 0;
+    pcfile **tail = &head;
+    for (struct dirent *e; (e = readdir(dir));) {
+        s8 name = s8fromcstr((u8 *)e->d_name);
+        if (name.len<3 || !s8equals(taketail(name, 3), S(".pc"))) {
+            continue;
+        }
+        pcfile *file = new(a, pcfile, 1);
+        file->name = news8(a, name.len);
+        s8copy(file->name, name);
+        *tail = file;
+        tail = &file->next;
+    }
+
+    closedir(dir);
+    return head;
+}
+
+static b32 os_writefile(os *ctx, arena *a, s8 path, s8 data)
+{
+    assert(ctx);
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    // Write to a unique temporary beside the target, then rename it over
+    // the target so that concurrent readers never see a partial file.
+    arena scratch = *a;
+    u8buf buf = newmembuf(&scratch);
+    prints8(&buf, cuttail(path, 1));
+    printu8(&buf, '.');
+    for (u32 pid = (u32)getpid(); pid; pid >>= 4) {
+        printu8(&buf, "0123456789abcdef"[pid&15]);
+    }
+    prints8(&buf, S(".tmp\0"));
+    s8 tmp = finalize(&buf);
+
+    int fd = open((char *)tmp.s, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd == -1) {
+        return 0;
+    }
+
+    b32 ok = 1;
+    for (iz off = 0; ok && off<data.len;) {
+        iz len = write(fd, data.s+off, data.len-off);
+        if (len==-1 && errno==EINTR) {
+            continue;
+        }
+        ok = len > 0;
+        off += len;
+    }
+    ok = !close(fd) && ok;
+
+    ok = ok && !rename((char *)tmp.s, (char *)path.s);
+    if (!ok) {
+        unlink((char *)tmp.s);
+    }
+    return ok;
+}
+
+static iz os_read(os *ctx, u8 *buf, iz cap)
+{
+    assert(ctx);
+    for (;;) {
+        iz len = read(0, buf, cap);
+        if (len==-1 && errno==EINTR) {
+            continue;
+        }
+        return len<0 ? 0 : len;
+    }
+}
+
+static void os_fail(os *ctx)
+{
+    assert(ctx);
+    if (ctx->trap) {
+        __builtin_longjmp(ctx->trap, 1);
+    }
+    exit(1);
+}
+
+static void os_trap(os *ctx, void **jmp)
+{
+    ctx->trap = jmp;
+}
+
+// Runs sequentially: local file systems answer quickly from cache, and
+// threads would require linking with pthreads on some systems.
+static void os_parallel(os *ctx, void (*work)(void *, iz, arena *), void *arg, iz n)
+{
+    if (!ctx->scratch.beg) {
+        ctx->scratch = newarena_(1<<22);
+        ctx->scratch.ctx = ctx;
+    }
+    arena perm = ctx->scratch;
+    for (iz i = 0; i < n; i++) {
+        work(arg, i, &perm);
+    }
+}
+
+static void os_write(os *ctx, i32 fd, s8 s)
+{
+    assert(fd==1 || fd==2);
+    if (ctx->err[fd] || (fd==1 && ctx->quiet)) {
+        return;
+    }
+    for (iz off = 0; off < s.len;) {
+        iz len = write(fd, s.s+off, s.len-off);
+        if (len==-1 && errno==EINTR) {
+            continue;
+        } else if (len < 1) {
+            ctx->err[fd] = 1;
+            return;
+        }
+        off += len;
+    }
+}
+
+#ifdef BENCH
+// Benchmark harness: generates a synthetic package forest in a temporary
+// directory, then reports the mean latency of representative queries.
+// $ cc -O2 -DBENCH -o bench pkg-config.c && ./bench [ITERATIONS]
+#include <time.h>
+
+enum {
+    BENCH_DEPTH = 64,   // length of the deep Requires chain
+    BENCH_WIDTH = 256,  // leaf packages, all required by "wide"
+    BENCH_VARS  = 24,   // chained variables per package
+    BENCH_FLAGS = 32,   // Cflags and Libs entries per package
+};
+
+static b32 benchpkg_(char *dir, char *name, char *requires)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.pc", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+
+    fprintf(f, "prefix=/opt/%s\n", name);
+    fprintf(f, "v0=${prefix}\n");
+    for (i32 i = 1; i < BENCH_VARS; i++) {
+        fprintf(f, "v%d=${v%d}/%d\n", i, i-1, i);
+    }
+    fprintf(f, "\nName: %s\n", name);
+    fprintf(f, "Description: synthetic package %s\n", name);
+    fprintf(f, "Version: 1.0.%d\n", BENCH_FLAGS);
+    if (requires) {
+        fprintf(f, "Requires: %s\n", requires);
+    }
+    fprintf(f, "Cflags:");
+    for (i32 i = 0; i < BENCH_FLAGS; i++) {
+        fprintf(f, " -I${v%d}/include -DCOMMON%d", i%BENCH_VARS, i%4);
+    }
+    fprintf(f, "\nLibs: -L${v%d}/lib", BENCH_VARS-1);
+    for (i32 i = 0; i < BENCH_FLAGS; i++) {
+        fprintf(f, " -l%s_%d -lcommon%d", name, i, i%4);
+    }
+    fprintf(f, "\nLibs.private: -lpthread -lm\n");
+
+    if (fclose(f)) {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+// Deep: deep0 -> deep1 -> ... with each also requiring one leaf.
+// Wide: a single package directly requiring every leaf.
+static b32 benchforest_(char *dir)
+{
+    char name[32];
+    char requires[BENCH_WIDTH*16];
+    for (i32 i = 0; i < BENCH_WIDTH; i++) {
+        snprintf(name, sizeof(name), "leaf%d", i);
+        if (!benchpkg_(dir, name, 0)) {
+            return 0;
+        }
+    }
+    for (i32 i = 0; i < BENCH_DEPTH; i++) {
+        snprintf(name, sizeof(name), "deep%d", i);
+        b32 ok = 1;
+        if (i < BENCH_DEPTH-1) {
+            snprintf(requires, sizeof(requires), "deep%d, leaf%d", i+1, i);
+            ok = benchpkg_(dir, name, requires);
+        } else {
+            ok = benchpkg_(dir, name, "leaf0");
+        }
+        if (!ok) {
+            return 0;
+        }
+    }
+    i32 len = 0;
+    for (i32 i = 0; i < BENCH_WIDTH; i++) {
+        len += snprintf(requires+len, sizeof(requires)-len, " leaf%d", i);
+    }
+    return benchpkg_(dir, "wide", requires);
+}
+
+static void benchclean_(char *dir)
+{
+    DIR *d = opendir(dir);
+    for (struct dirent *e; d && (e = readdir(d));) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (*e->d_name != '.') {
+            unlink(path);
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    i32 iterations = argc>1 ? atoi(argv[1]) : 1000;
+    iterations = iterations<1 ? 1 : iterations;
+
+    char dir[] = "/tmp/u-config-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    if (!benchforest_(dir)) {
+        benchclean_(dir);
+        return 1;
+    }
+
+    os ctx[1] = {0};
+    ctx->quiet = 1;
+    config *base = newconfig_(ctx, 1<<24);
+    base->envpath = S("");
+    base->fixedpath = s8fromcstr((u8 *)dir);
+    base->cachedir = S("");
+
+    static const struct {
+        char *label;
+        char *args[4];
+    } queries[] = {
+        {"resolve deep",            {"--exists", "deep0"}},
+        {"resolve wide",            {"--exists", "wide"}},
+        {"--modversion leaf",       {"--modversion", "leaf0"}},
+        {"--cflags --libs deep",    {"--cflags", "--libs", "deep0"}},
+        {"--cflags --libs wide",    {"--cflags", "--libs", "wide"}},
+        {"--static --libs wide",    {"--static", "--libs", "wide"}},
+        {"--list-all",              {"--list-all"}},
+        {"--list-package-names",    {"--list-package-names"}},
+    };
+
+    printf("%d packages, %d iterations per query\n",
+           BENCH_DEPTH+BENCH_WIDTH+1, iterations);
+    for (i32 q = 0; q < countof(queries); q++) {
+        i32 nargs = 0;
+        for (; nargs<countof(queries[q].args) && queries[q].args[nargs]; nargs++) {}
+
+        struct timespec beg, end;
+        clock_gettime(CLOCK_MONOTONIC, &beg);
+        for (i32 i = 0; i < iterations; i++) {
+            config conf = *base;  // fresh copy of the arena each run
+            conf.args  = (u8 **)queries[q].args;
+            conf.nargs = nargs;
+            uconfig(&conf);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ns = (end.tv_sec - beg.tv_sec)*1e9 + (end.tv_nsec - beg.tv_nsec);
+        printf("%-24s %10.1f us\n", queries[q].label, ns/iterations/1e3);
+    }
+
+    benchclean_(dir);
+    return ctx->err[1] || ctx->err[2];
+}
+#endif  // BENCH
+
+#endif  // _WIN32
@@ -23,6 +23,7 @@
 #include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -55,6 +56,13 @@ inline ptrdiff_t str_rfind(std::string_view s, char c) {
     return r == std::string_view::npos ? ptrdiff_t{-1} : static_cast<ptrdiff_t>(r);
 }
 
+// Hash for string-keyed maps that can be probed with a string_view.
+struct NameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+using NameIndex = std::unordered_map<std::string, ptrdiff_t, NameHash, std::equal_to<>>;
+
 // Quilt .pc/ directory state
 struct QuiltState {
     std::string work_dir;        // project root
@@ -70,10 +78,22 @@ struct QuiltState {
     std::set<std::string> patch_reversed;          // patches marked -R in series
     std::map<std::string, std::string> config;     // merged quiltrc + env settings
 
+    // Position indexes over series and applied, so the lookups below are
+    // O(1).  push_applied/pop_applied keep them current; after any other
+    // change to series or applied, call reindex().
+    NameIndex series_pos;            // first position of each name in series
+    NameIndex applied_pos;           // position of each name in applied
+    std::vector<bool> applied_mask;  // per series position: is it applied?
+    void reindex();
+    void push_applied(std::string_view patch);
+    void pop_applied();
+
     // Computed helpers
     ptrdiff_t top_index() const;     // index of topmost applied in series (-1 if none)
     bool is_applied(std::string_view patch) const;
+    bool is_applied_at(ptrdiff_t series_idx) const;
     std::optional<ptrdiff_t> find_in_series(std::string_view patch) const;
+    std::optional<ptrdiff_t> find_in_applied(std::string_view patch) const;
     int get_strip_level(std::string_view patch) const;  // returns 1 if not set
     std::string get_p_format(std::string_view patch) const;  // "0" or "1"
 };
@@ -94,6 +114,7 @@ std::string strip_trailing_slash(std::string_view s);
 // String utilities
 std::string trim(std::string_view s);
 std::vector<std::string> split_lines(std::string_view s);
+std::vector<std::string_view> split_line_views(std::string_view s);
 std::vector<std::string> split_on_whitespace(std::string_view s);
 std::vector<std::string> shell_split(std::string_view s);
 
@@ -112,6 +133,9 @@ struct PatchOptions {
     // in builtin_patch uses this map instead of real syscalls.
     // Key present = file exists, value = content.
     std::map<std::string, std::string> *fs = nullptr;
+    // When non-null, only files whose target (or rename/copy source) is in
+    // this set are patched; the rest of the patch is skipped silently.
+    const std::set<std::string> *only_files = nullptr;
 };
 
 struct PatchResult {
@@ -122,6 +146,13 @@ struct PatchResult {
 
 PatchResult builtin_patch(std::string_view patch_text, const PatchOptions &opts);
 
+// Git extensions understood by the patch engine
+std::pair<std::string, std::string> git_diff_names(std::string_view rest, int strip);
+std::vector<std::pair<std::string, std::string>>
+git_renames(std::string_view patch_text, int strip_level);
+std::string git_blob_id(std::string_view content);
+std::string git_binary_patch(std::string_view old_content, std::string_view new_content);
+
 // Built-in diff engine
 enum class DiffFormat { unified, context };
 enum class DiffAlgorithm { myers, minimal, patience, histogram };
@@ -141,6 +172,15 @@ DiffResult builtin_diff(std::string_view old_path, std::string_view new_path,
                          DiffAlgorithm algorithm = DiffAlgorithm::myers,
                          std::map<std::string, std::string> *fs = nullptr);
 
+// Diff two buffers that are already in memory.
+DiffResult builtin_diff_buffers(std::string_view old_content,
+                                std::string_view new_content,
+                                int context_lines,
+                                std::string_view old_label,
+                                std::string_view new_label,
+                                DiffFormat format = DiffFormat::unified,
+                                DiffAlgorithm algorithm = DiffAlgorithm::myers);
+
 // Patch name helpers — shared across command files
 inline std::string_view strip_patches_prefix(const QuiltState &q, std::string_view name) {
     if (name.starts_with(q.patches_dir) &&
@@ -167,6 +207,7 @@ inline std::string subdir_path(const QuiltState &q, std::string_view file) {
 bool ensure_pc_dir(QuiltState &q);
 std::string pc_patch_dir(const QuiltState &q, std::string_view patch);
 std::vector<std::string> files_in_patch(const QuiltState &q, std::string_view patch);
+std::map<std::string, std::vector<ptrdiff_t>> applied_files_index(const QuiltState &q);
 bool backup_file(QuiltState &q, std::string_view patch, std::string_view file);
 bool restore_file(QuiltState &q, std::string_view patch, std::string_view file);
 std::vector<std::string> read_series(std::string_view path,
@@ -178,6 +219,15 @@ bool write_series(std::string_view path, std::span<const std::string> patches,
 std::vector<std::string> read_applied(std::string_view path);
 bool write_applied(std::string_view path, std::span<const std::string> patches);
 
+// Decode a raw deflate stream onto the end of out.  Returns the number of
+// input bytes consumed, or -1 when the stream is malformed or truncated.
+ptrdiff_t inflate_raw(std::string_view in, std::string &out);
+
+// Read or write a patch file, (de)compressing .gz and .zst names.  A
+// missing file reads as empty; nullopt means it could not be decoded.
+std::optional<std::string> read_patch_file(std::string_view path);
+bool write_patch_file(std::string_view path, std::string_view content);
+
 // Command function type
 using CmdFn = int (*)(QuiltState &q, int argc, char **argv);
 
@@ -241,6 +291,7 @@ int cmd_shell(QuiltState &q, int argc, char **argv);
 // === src/platform.hpp ===
 
 // This is free and unencumbered software released into the public domain.
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -258,6 +309,12 @@ ProcessResult run_cmd_input(const std::vector<std::string> &argv,
                             std::string_view stdin_data);
 int run_cmd_tty(const std::vector<std::string> &argv);
 
+// Run several commands, at most max_jobs at a time, draining all their
+// output concurrently.  Results come back in the order of argvs.
+std::vector<ProcessResult> run_cmds(std::span<const std::vector<std::string>> argvs,
+                                    int max_jobs);
+int cpu_count();
+
 // File system operations
 std::string read_file(std::string_view path);
 bool write_file(std::string_view path, std::string_view content);
@@ -272,6 +329,16 @@ bool file_exists(std::string_view path);
 bool is_directory(std::string_view path);
 int64_t file_mtime(std::string_view path);  // -1 on failure
 
+// Size and last write time at the file system's full resolution, for
+// cheap change detection.  copy_file preserves both.  False if the path
+// is missing or a directory.
+struct FileStamp {
+    int64_t size;
+    int64_t write_time;  // platform units; compare only with each other
+    bool operator==(const FileStamp &) const = default;
+};
+bool file_stamp(std::string_view path, FileStamp &stamp);
+
 struct DirEntry {
     std::string name;
     bool        is_dir;
@@ -292,9 +359,13 @@ std::string get_cwd();
 bool set_cwd(std::string_view path);
 std::string get_system_quiltrc();
 
-// I/O
+// I/O.  Standard output may be buffered; the platform layer flushes it
+// before starting a child process, before reading stdin, at the end of
+// each line on a console, and at exit, and keeps its order relative to
+// standard error intact.
 void fd_write_stdout(std::string_view s);
 void fd_write_stderr(std::string_view s);
+void fd_flush();
 bool stdout_is_tty();
 
 // Read all of stdin
@@ -321,28 +392,63 @@ int quilt_main(int argc, char **argv);
 // === src/core.cpp ===
 
 // This is free and unencumbered software released into the public domain.
+#include <array>
 
-ptrdiff_t QuiltState::top_index() const {
-    if (applied.empty()) return -1;
-    const std::string &top = applied.back();
+void QuiltState::reindex() {
+    series_pos.clear();
+    series_pos.reserve(series.size());
     for (ptrdiff_t i = 0; i < std::ssize(series); ++i) {
-        if (series[checked_cast<size_t>(i)] == top) return i;
+        series_pos.try_emplace(series[checked_cast<size_t>(i)], i);
+    }
+    applied_pos.clear();
+    applied_pos.reserve(applied.size());
+    applied_mask.assign(series.size(), false);
+    for (ptrdiff_t i = 0; i < std::ssize(applied); ++i) {
+        const std::string &name = applied[checked_cast<size_t>(i)];
+        applied_pos.try_emplace(name, i);
+        if (auto idx = find_in_series(name)) applied_mask[checked_cast<size_t>(*idx)] = true;
     }
-    return -1;
 }
 
-bool QuiltState::is_applied(std::string_view patch) const {
-    for (const auto &a : applied) {
-        if (a == patch) return true;
+void QuiltState::push_applied(std::string_view patch) {
+    applied_pos.try_emplace(std::string(patch), std::ssize(applied));
+    applied.emplace_back(patch);
+    if (auto idx = find_in_series(patch)) applied_mask[checked_cast<size_t>(*idx)] = true;
+}
+
+void QuiltState::pop_applied() {
+    const std::string &top = applied.back();
+    auto it = applied_pos.find(top);
+    if (it != applied_pos.end() && it->second == std::ssize(applied) - 1) {
+        applied_pos.erase(it);
+        if (auto idx = find_in_series(top)) applied_mask[checked_cast<size_t>(*idx)] = false;
     }
-    return false;
+    applied.pop_back();
+}
+
+ptrdiff_t QuiltState::top_index() const {
+    if (applied.empty()) return -1;
+    return find_in_series(applied.back()).value_or(-1);
+}
+
+bool QuiltState::is_applied(std::string_view patch) const {
+    return applied_pos.contains(patch);
+}
+
+bool QuiltState::is_applied_at(ptrdiff_t series_idx) const {
+    return applied_mask[checked_cast<size_t>(series_idx)];
 }
 
 std::optional<ptrdiff_t> QuiltState::find_in_series(std::string_view patch) const {
-    for (ptrdiff_t i = 0; i < std::ssize(series); ++i) {
-        if (series[checked_cast<size_t>(i)] == patch) return i;
-    }
-    return std::nullopt;
+    auto it = series_pos.find(patch);
+    if (it == series_pos.end()) return std::nullopt;
+    return it->second;
+}
+
+std::optional<ptrdiff_t> QuiltState::find_in_applied(std::string_view patch) const {
+    auto it = applied_pos.find(patch);
+    if (it == applied_pos.end()) return std::nullopt;
+    return it->second;
 }
 
 int QuiltState::get_strip_level(std::string_view patch) const {
@@ -458,6 +564,25 @@ std::vector<std::string> split_lines(std::string_view s) {
     return lines;
 }
 
+// Like split_lines, but the lines point into s instead of being copied.
+std::vector<std::string_view> split_line_views(std::string_view s) {
+    std::vector<std::string_view> lines;
+    while (!s.empty()) {
+        auto pos = str_find(s, '\n');
+        if (pos < 0) {
+            if (s.back() == '\r')
+                s.remove_suffix(1);
+            lines.push_back(s);
+            break;
+        }
+        auto end = checked_cast<size_t>(pos);
+        if (end > 0 && s[end - 1] == '\r')
+            --end;
+        lines.push_back(s.substr(0, end));
+        s.remove_prefix(checked_cast<size_t>(pos + 1));
+    }
+    return lines;
+}
 
 std::vector<std::string> split_on_whitespace(std::string_view s) {
     std::vector<std::string> tokens;
@@ -643,6 +768,280 @@ bool write_applied(std::string_view path, std::span<const std::string> patches)
     return write_file(path, content);
 }
 
+// ── Compressed data ────────────────────────────────────────────────────
+
+// Deflate decoding (RFC 1951), in the style of zlib's puff.
+struct InflateBits {
+    std::string_view in;
+    ptrdiff_t pos = 0;
+    uint32_t bits = 0;
+    int count = 0;
+    bool overrun = false;
+
+    int take(int n) {
+        while (count < n) {
+            if (pos >= std::ssize(in)) {
+                overrun = true;
+                return 0;
+            }
+            bits |= uint32_t(uint8_t(in[checked_cast<size_t>(pos++)])) << count;
+            count += 8;
+        }
+        int v = int(bits & ((uint32_t{1} << n) - 1));
+        bits >>= n;
+        count -= n;
+        return v;
+    }
+};
+
+struct InflateTable {
+    uint16_t counts[16] = {};
+    uint16_t symbols[288] = {};
+};
+
+// Build a canonical Huffman table; false when the lengths over-subscribe.
+static bool inflate_table(InflateTable &t, const uint8_t *lengths, int n)
+{
+    for (int i = 0; i < n; ++i) t.counts[lengths[i]]++;
+    t.counts[0] = 0;
+    int left = 1;
+    for (int len = 1; len < 16; ++len) {
+        left = (left << 1) - t.counts[len];
+        if (left < 0) return false;
+    }
+    uint16_t offs[16] = {};
+    for (int len = 1; len < 15; ++len) {
+        offs[len + 1] = uint16_t(offs[len] + t.counts[len]);
+    }
+    for (int i = 0; i < n; ++i) {
+        if (lengths[i]) t.symbols[offs[lengths[i]]++] = uint16_t(i);
+    }
+    return true;
+}
+
+static int inflate_symbol(InflateBits &br, const InflateTable &t)
+{
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; ++len) {
+        code |= br.take(1);
+        int count = t.counts[len];
+        if (code - count < first) return t.symbols[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+ptrdiff_t inflate_raw(std::string_view in, std::string &out)
+{
+    static constexpr uint16_t len_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static constexpr uint8_t len_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static constexpr uint16_t dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577};
+    static constexpr uint8_t dist_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    static constexpr uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    InflateBits br{in};
+    ptrdiff_t start = std::ssize(out);
+    for (bool last = false; !last;) {
+        last = br.take(1);
+        int type = br.take(2);
+        if (type == 0) {
+            // Stored block: byte aligned LEN and its complement
+            br.bits = 0;
+            br.count = 0;
+            if (br.pos + 4 > std::ssize(in)) return -1;
+            auto byte = [&](ptrdiff_t k) { return unsigned(uint8_t(in[checked_cast<size_t>(br.pos + k)])); };
+            unsigned len = byte(0) | byte(1) << 8;
+            unsigned nlen = byte(2) | byte(3) << 8;
+            br.pos += 4;
+            if (len != (~nlen & 0xffff) || br.pos + len > std::ssize(in)) return -1;
+            out.append(in.substr(checked_cast<size_t>(br.pos), len));
+            br.pos += len;
+            continue;
+        }
+        if (type == 3) return -1;
+
+        InflateTable lit, dist;
+        uint8_t lengths[320] = {};
+        int nlit = 288, ndist = 30;
+        if (type == 1) {
+            for (int i = 0; i < 144; ++i) lengths[i] = 8;
+            for (int i = 144; i < 256; ++i) lengths[i] = 9;
+            for (int i = 256; i < 280; ++i) lengths[i] = 7;
+            for (int i = 280; i < 288; ++i) lengths[i] = 8;
+            for (int i = 0; i < 30; ++i) lengths[288 + i] = 5;
+        } else {
+            nlit = br.take(5) + 257;
+            ndist = br.take(5) + 1;
+            int ncode = br.take(4) + 4;
+            if (nlit > 286 || ndist > 30) return -1;
+            uint8_t code_lengths[19] = {};
+            for (int i = 0; i < ncode; ++i) code_lengths[order[i]] = uint8_t(br.take(3));
+            InflateTable lencode;
+            if (!inflate_table(lencode, code_lengths, 19)) return -1;
+            for (int i = 0; i < nlit + ndist;) {
+                int sym = inflate_symbol(br, lencode);
+                if (sym < 0 || br.overrun) return -1;
+                if (sym < 16) {
+                    lengths[i++] = uint8_t(sym);
+                    continue;
+                }
+                int repeat = 0;
+                uint8_t value = 0;
+                if (sym == 16) {
+                    if (i == 0) return -1;
+                    value = lengths[i - 1];
+                    repeat = 3 + br.take(2);
+                } else if (sym == 17) {
+                    repeat = 3 + br.take(3);
+                } else {
+                    repeat = 11 + br.take(7);
+                }
+                if (i + repeat > nlit + ndist) return -1;
+                while (repeat--) lengths[i++] = value;
+            }
+            // Distances follow the literal/length codes directly
+            std::memmove(lengths + 288, lengths + nlit, checked_cast<size_t>(ndist));
+        }
+        if (!inflate_table(lit, lengths, nlit) ||
+            !inflate_table(dist, lengths + 288, ndist)) {
+            return -1;
+        }
+
+        for (;;) {
+            int sym = inflate_symbol(br, lit);
+            if (sym < 0 || br.overrun) return -1;
+            if (sym < 256) {
+                out += char(sym);
+                continue;
+            }
+            if (sym == 256) break;
+            sym -= 257;
+            if (sym >= 29) return -1;
+            ptrdiff_t len = len_base[sym] + br.take(len_extra[sym]);
+            int dsym = inflate_symbol(br, dist);
+            if (dsym < 0 || dsym >= 30) return -1;
+            ptrdiff_t back = dist_base[dsym] + br.take(dist_extra[dsym]);
+            if (br.overrun || back > std::ssize(out) - start) return -1;
+            // Byte at a time: the copy may overlap its own output
+            size_t from = checked_cast<size_t>(std::ssize(out) - back);
+            for (ptrdiff_t k = 0; k < len; ++k) out += out[from + checked_cast<size_t>(k)];
+        }
+    }
+    return br.overrun ? -1 : br.pos;
+}
+
+static uint32_t crc32(std::string_view data)
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xffffffff;
+    for (char ch : data) crc = table[(crc ^ uint8_t(ch)) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Decode a gzip file (RFC 1952), possibly several members back to back.
+static std::optional<std::string> gunzip(std::string_view in)
+{
+    std::string out;
+    ptrdiff_t pos = 0, n = std::ssize(in);
+    auto byte = [&](ptrdiff_t at) { return uint32_t(uint8_t(in[checked_cast<size_t>(at)])); };
+    auto le32 = [&](ptrdiff_t at) {
+        return byte(at) | byte(at + 1) << 8 | byte(at + 2) << 16 | byte(at + 3) << 24;
+    };
+    do {
+        if (n - pos < 18 || byte(pos) != 0x1f || byte(pos + 1) != 0x8b || byte(pos + 2) != 8) {
+            return std::nullopt;
+        }
+        uint32_t flags = byte(pos + 3);
+        pos += 10;
+        if (flags & 4) {  // FEXTRA
+            if (n - pos < 2) return std::nullopt;
+            pos += 2 + ptrdiff_t(byte(pos) | byte(pos + 1) << 8);
+        }
+        for (uint32_t flag : {8u, 16u}) {  // FNAME, FCOMMENT
+            if (!(flags & flag)) continue;
+            while (pos < n && in[checked_cast<size_t>(pos)]) ++pos;
+            ++pos;
+        }
+        if (flags & 2) pos += 2;  // FHCRC
+        if (pos > n) return std::nullopt;
+
+        ptrdiff_t start = std::ssize(out);
+        ptrdiff_t used = inflate_raw(in.substr(checked_cast<size_t>(pos)), out);
+        if (used < 0 || n - (pos + used) < 8) return std::nullopt;
+        pos += used;
+        std::string_view member = std::string_view(out).substr(checked_cast<size_t>(start));
+        if (le32(pos) != crc32(member) || le32(pos + 4) != uint32_t(member.size())) {
+            return std::nullopt;
+        }
+        pos += 8;
+    } while (pos < n);
+    return out;
+}
+
+// Patches may be stored compressed, as named by their suffix.  gzip is
+// decoded in process since every push reads it; zstd, like busybox's
+// unzstd support, goes through the external tool.  Writing either uses
+// the external compressor.  Failures are reported here.
+std::optional<std::string> read_patch_file(std::string_view path)
+{
+    if (path.ends_with(".gz")) {
+        std::string packed = read_file(path);
+        if (packed.empty()) return packed;
+        auto text = gunzip(packed);
+        if (!text) err_line("quilt: " + std::string(path) + ": invalid gzip data");
+        return text;
+    }
+    if (path.ends_with(".zst")) {
+        if (!file_exists(path)) return std::string{};
+        ProcessResult r = run_cmd({"zstd", "-d", "-c", "-q", "--", std::string(path)});
+        if (r.exit_code != 0) {
+            err_line("quilt: " + std::string(path) + ": " + (r.err.empty() ? "zstd failed" : trim(r.err)));
+            return std::nullopt;
+        }
+        return std::move(r.out);
+    }
+    return read_file(path);
+}
+
+bool write_patch_file(std::string_view path, std::string_view content)
+{
+    std::vector<std::string> argv;
+    if (path.ends_with(".gz")) {
+        argv = {"gzip", "-n", "-c"};
+    } else if (path.ends_with(".zst")) {
+        argv = {"zstd", "-q", "-c"};
+    } else {
+        return write_file(path, content);
+    }
+    ProcessResult r = run_cmd_input(argv, content);
+    if (r.exit_code != 0) {
+        err_line("quilt: " + std::string(path) + ": " + (r.err.empty() ? argv[0] + " failed" : trim(r.err)));
+        return false;
+    }
+    return write_file(path, r.out);
+}
+
+
 bool ensure_pc_dir(QuiltState &q) {
     std::string pc = path_join(q.work_dir, q.pc_dir);
     if (!is_directory(pc)) {
@@ -860,6 +1259,7 @@ QuiltState load_state() {
     // Read applied-patches file
     std::string applied_abs = path_join(q.work_dir, q.pc_dir, "applied-patches");
     q.applied = read_applied(applied_abs);
+    q.reindex();
 
     return q;
 }
@@ -885,6 +1285,37 @@ std::vector<std::string> files_in_patch(const QuiltState &q, std::string_view pa
     return result;
 }
 
+// Map each file tracked by an applied patch to the positions (indices into
+// q.applied, ascending) of the patches that track it.  Built from a single
+// recursive walk of .pc/ instead of one directory scan per patch.
+std::map<std::string, std::vector<ptrdiff_t>> applied_files_index(const QuiltState &q) {
+    std::map<std::string, ptrdiff_t, std::less<>> position;
+    for (ptrdiff_t i = 0; i < std::ssize(q.applied); ++i) {
+        position.emplace(q.applied[checked_cast<size_t>(i)], i);
+    }
+
+    std::map<std::string, std::vector<ptrdiff_t>> index;
+    for (const auto &f : find_files_recursive(path_join(q.work_dir, q.pc_dir))) {
+        std::string_view path = f;
+        // Skip quilt metadata files (e.g. .timestamp, .needs_refresh)
+        auto last = str_rfind(path, '/');
+        if (last < 0 || path[checked_cast<size_t>(last + 1)] == '.') continue;
+        // Patch names may contain '/', so try each leading directory in turn
+        for (auto slash = str_find(path, '/'); slash >= 0 && slash <= last;
+             slash = str_find(path, '/', slash + 1)) {
+            auto it = position.find(path.substr(0, checked_cast<size_t>(slash)));
+            if (it == position.end()) continue;
+            index[std::string(path.substr(checked_cast<size_t>(slash + 1)))]
+                .push_back(it->second);
+            break;
+        }
+    }
+    for (auto &[file, stack] : index) {
+        std::ranges::sort(stack);
+    }
+    return index;
+}
+
 bool backup_file(QuiltState &q, std::string_view patch, std::string_view file) {
     std::string src = path_join(q.work_dir, file);
     std::string dst = path_join(pc_patch_dir(q, patch), file);
@@ -1005,7 +1436,7 @@ static Command commands[] = {
     {"refresh", cmd_refresh,
      "Usage: quilt refresh [-p n] [-u | -U num | -c | -C num] [-z [new_name]]\n"
      "       [-f] [--no-timestamps] [--no-index] [--diffstat] [--sort]\n"
-     "       [--strip-trailing-whitespace] [--backup]\n"
+     "       [--strip-trailing-whitespace] [--backup] [--find-renames]\n"
      "       [--diff-algorithm={myers|minimal|patience|histogram}] [patch]\n"
      "\n"
      "Regenerate the topmost or named patch by diffing backup copies in\n"
@@ -1029,6 +1460,8 @@ static Command commands[] = {
      "  --strip-trailing-whitespace\n"
      "                    Strip trailing whitespace from each line.\n"
      "  --backup          Save the old patch file as name~ before updating.\n"
+     "  --find-renames    Record a file deleted and another created with\n"
+     "                    mostly the same lines as a git-style rename.\n"
      "  --diff-algorithm=name\n"
      "                    Select the diff algorithm: myers (default),\n"
      "                    minimal, patience, or histogram.\n"
@@ -1753,84 +2186,64 @@ found:
 //
 // Anchors on lines that appear exactly once in each file, computes their
 // longest increasing subsequence (LIS) via patience sorting, and recurses
-// on the gaps between anchors.  Falls back to Myers (minimal) when no
-// unique common lines exist.
-static std::vector<EditOp> patience_diff(
-    std::span<const std::string_view> old_lines,
-    std::span<const std::string_view> new_lines)
-{
-    ptrdiff_t n = std::ssize(old_lines);
-    ptrdiff_t m = std::ssize(new_lines);
+// on the gaps between anchors.  Lines are interned to integer ids once up
+// front, so each gap only counts ids in flat per-id arrays (and clears
+// them again) instead of building a fresh hash map.  Falls back to
+// cost-bounded Myers when a gap has no unique common lines, so files full
+// of duplicate lines cannot trigger an unbounded minimal search.
+struct PatienceState {
+    std::span<const std::string_view> old_lines;
+    std::span<const std::string_view> new_lines;
+    std::vector<ptrdiff_t> old_ids;    // interned id of each old line
+    std::vector<ptrdiff_t> new_ids;    // interned id of each new line
+    std::vector<int> old_count;        // per id: occurrences in current gap
+    std::vector<int> new_count;
+    std::vector<ptrdiff_t> new_pos;    // per id: position in current gap
+};
 
-    if (n == 0 && m == 0) return {};
-    if (n == 0) {
-        std::vector<EditOp> ops;
-        for (ptrdiff_t j = 0; j < m; ++j)
-            ops.push_back({'I', -1, j});
-        return ops;
-    }
-    if (m == 0) {
-        std::vector<EditOp> ops;
-        for (ptrdiff_t i = 0; i < n; ++i)
-            ops.push_back({'D', i, -1});
-        return ops;
-    }
+static void patience_range(PatienceState &st,
+                           ptrdiff_t old_lo, ptrdiff_t old_hi,
+                           ptrdiff_t new_lo, ptrdiff_t new_hi,
+                           std::vector<EditOp> &ops)
+{
+    auto old_id = [&](ptrdiff_t i) { return st.old_ids[checked_cast<size_t>(i)]; };
+    auto new_id = [&](ptrdiff_t j) { return st.new_ids[checked_cast<size_t>(j)]; };
 
     // Step 1: Match common prefix and suffix.
-    ptrdiff_t prefix = 0;
-    while (prefix < n && prefix < m &&
-           old_lines[checked_cast<size_t>(prefix)] == new_lines[checked_cast<size_t>(prefix)])
-        ++prefix;
+    while (old_lo < old_hi && new_lo < new_hi && old_id(old_lo) == new_id(new_lo))
+        ops.push_back({'E', old_lo++, new_lo++});
 
     ptrdiff_t suffix = 0;
-    while (suffix < (n - prefix) && suffix < (m - prefix) &&
-           old_lines[checked_cast<size_t>(n - 1 - suffix)] == new_lines[checked_cast<size_t>(m - 1 - suffix)])
+    while (old_hi - suffix > old_lo && new_hi - suffix > new_lo &&
+           old_id(old_hi - 1 - suffix) == new_id(new_hi - 1 - suffix))
         ++suffix;
+    old_hi -= suffix;
+    new_hi -= suffix;
 
-    ptrdiff_t inner_old_len = n - prefix - suffix;
-    ptrdiff_t inner_new_len = m - prefix - suffix;
-
-    // If prefix + suffix covers everything, no interior to diff.
-    if (inner_old_len <= 0 && inner_new_len <= 0) {
-        std::vector<EditOp> ops;
-        for (ptrdiff_t i = 0; i < n; ++i)
-            ops.push_back({'E', i, i});
-        return ops;
-    }
-
-    // Step 2: Find unique common lines in the interior.
-    // Map line content → (count_in_old, old_idx, count_in_new, new_idx).
-    struct LineInfo {
-        int old_count = 0;
-        ptrdiff_t old_idx = -1;
-        int new_count = 0;
-        ptrdiff_t new_idx = -1;
-    };
-    std::unordered_map<std::string_view, LineInfo> line_map;
-
-    for (ptrdiff_t i = 0; i < inner_old_len; ++i) {
-        auto &info = line_map[old_lines[checked_cast<size_t>(prefix + i)]];
-        info.old_count++;
-        info.old_idx = i;  // keeps last occurrence, but we only care when count==1
-    }
-    for (ptrdiff_t j = 0; j < inner_new_len; ++j) {
-        auto &info = line_map[new_lines[checked_cast<size_t>(prefix + j)]];
-        info.new_count++;
-        info.new_idx = j;
-    }
-
-    // Collect unique matches, sorted by old_idx (natural insertion order
-    // from scanning, but we sort explicitly to be safe).
+    // Step 2: Find unique common lines in the interior.  Scanning the old
+    // side in order yields the matches already sorted by old index.
     struct Match { ptrdiff_t old_idx; ptrdiff_t new_idx; };
     std::vector<Match> unique_matches;
-    for (const auto &[line, info] : line_map) {
-        if (info.old_count == 1 && info.new_count == 1) {
-            unique_matches.push_back({info.old_idx, info.new_idx});
-        }
-    }
-    std::ranges::sort(unique_matches, {}, &Match::old_idx);
-
-    // Step 3: LIS of new_idx values via patience sorting.
+    if (old_lo < old_hi && new_lo < new_hi) {
+        for (ptrdiff_t i = old_lo; i < old_hi; ++i)
+            st.old_count[checked_cast<size_t>(old_id(i))]++;
+        for (ptrdiff_t j = new_lo; j < new_hi; ++j) {
+            auto id = checked_cast<size_t>(new_id(j));
+            st.new_count[id]++;
+            st.new_pos[id] = j;
+        }
+        for (ptrdiff_t i = old_lo; i < old_hi; ++i) {
+            auto id = checked_cast<size_t>(old_id(i));
+            if (st.old_count[id] == 1 && st.new_count[id] == 1)
+                unique_matches.push_back({i, st.new_pos[id]});
+        }
+        for (ptrdiff_t i = old_lo; i < old_hi; ++i)
+            st.old_count[checked_cast<size_t>(old_id(i))] = 0;
+        for (ptrdiff_t j = new_lo; j < new_hi; ++j)
+            st.new_count[checked_cast<size_t>(new_id(j))] = 0;
+    }
+
+    // Step 3: LIS of new_idx values via patience sorting, O(k log k).
     // Each pile stores (new_idx, back_pointer into flat list).
     struct Card {
         ptrdiff_t new_idx;
@@ -1873,82 +2286,61 @@ static std::vector<EditOp> patience_diff(
         std::ranges::reverse(anchors);
     }
 
-    // If no unique anchors found, fall back to Myers (minimal) on the interior.
     if (anchors.empty()) {
-        auto inner_old = old_lines.subspan(checked_cast<size_t>(prefix),
-                                           checked_cast<size_t>(inner_old_len));
-        auto inner_new = new_lines.subspan(checked_cast<size_t>(prefix),
-                                           checked_cast<size_t>(inner_new_len));
-        auto inner_ops = myers_diff(inner_old, inner_new, DiffAlgorithm::minimal);
-
-        // Assemble: prefix + inner + suffix
-        std::vector<EditOp> ops;
-        for (ptrdiff_t i = 0; i < prefix; ++i)
-            ops.push_back({'E', i, i});
-        for (auto &op : inner_ops) {
-            if (op.old_idx >= 0) op.old_idx += prefix;
-            if (op.new_idx >= 0) op.new_idx += prefix;
+        // No anchors: cost-bounded Myers on the interior (also covers the
+        // cases where one side is empty).
+        auto inner_old = st.old_lines.subspan(checked_cast<size_t>(old_lo),
+                                              checked_cast<size_t>(old_hi - old_lo));
+        auto inner_new = st.new_lines.subspan(checked_cast<size_t>(new_lo),
+                                              checked_cast<size_t>(new_hi - new_lo));
+        for (auto op : myers_diff(inner_old, inner_new, DiffAlgorithm::myers)) {
+            if (op.old_idx >= 0) op.old_idx += old_lo;
+            if (op.new_idx >= 0) op.new_idx += new_lo;
             ops.push_back(op);
         }
-        for (ptrdiff_t i = 0; i < suffix; ++i)
-            ops.push_back({'E', n - suffix + i, m - suffix + i});
-        return ops;
-    }
-
-    // Step 4: Recurse on gaps between anchors.
-    std::vector<EditOp> ops;
-
-    // Emit prefix
-    for (ptrdiff_t i = 0; i < prefix; ++i)
-        ops.push_back({'E', i, i});
-
-    ptrdiff_t prev_old = 0;  // interior-relative
-    ptrdiff_t prev_new = 0;
-
-    for (const auto &anchor : anchors) {
-        // Gap before this anchor
-        ptrdiff_t gap_old_len = anchor.old_idx - prev_old;
-        ptrdiff_t gap_new_len = anchor.new_idx - prev_new;
-
-        if (gap_old_len > 0 || gap_new_len > 0) {
-            auto gap_old = old_lines.subspan(checked_cast<size_t>(prefix + prev_old),
-                                             checked_cast<size_t>(gap_old_len));
-            auto gap_new = new_lines.subspan(checked_cast<size_t>(prefix + prev_new),
-                                             checked_cast<size_t>(gap_new_len));
-            auto gap_ops = patience_diff(gap_old, gap_new);
-            for (auto &op : gap_ops) {
-                if (op.old_idx >= 0) op.old_idx += prefix + prev_old;
-                if (op.new_idx >= 0) op.new_idx += prefix + prev_new;
-                ops.push_back(op);
-            }
-        }
-
-        // Emit the anchor as an equal match
-        ops.push_back({'E', prefix + anchor.old_idx, prefix + anchor.new_idx});
-        prev_old = anchor.old_idx + 1;
-        prev_new = anchor.new_idx + 1;
-    }
-
-    // Gap after last anchor
-    ptrdiff_t tail_old_len = inner_old_len - prev_old;
-    ptrdiff_t tail_new_len = inner_new_len - prev_new;
-    if (tail_old_len > 0 || tail_new_len > 0) {
-        auto tail_old = old_lines.subspan(checked_cast<size_t>(prefix + prev_old),
-                                          checked_cast<size_t>(tail_old_len));
-        auto tail_new = new_lines.subspan(checked_cast<size_t>(prefix + prev_new),
-                                          checked_cast<size_t>(tail_new_len));
-        auto tail_ops = patience_diff(tail_old, tail_new);
-        for (auto &op : tail_ops) {
-            if (op.old_idx >= 0) op.old_idx += prefix + prev_old;
-            if (op.new_idx >= 0) op.new_idx += prefix + prev_new;
-            ops.push_back(op);
+    } else {
+        // Step 4: Recurse on gaps between anchors.
+        ptrdiff_t prev_old = old_lo;
+        ptrdiff_t prev_new = new_lo;
+        for (const auto &anchor : anchors) {
+            if (anchor.old_idx > prev_old || anchor.new_idx > prev_new)
+                patience_range(st, prev_old, anchor.old_idx,
+                               prev_new, anchor.new_idx, ops);
+            ops.push_back({'E', anchor.old_idx, anchor.new_idx});
+            prev_old = anchor.old_idx + 1;
+            prev_new = anchor.new_idx + 1;
         }
+        if (old_hi > prev_old || new_hi > prev_new)
+            patience_range(st, prev_old, old_hi, prev_new, new_hi, ops);
     }
 
     // Emit suffix
     for (ptrdiff_t i = 0; i < suffix; ++i)
-        ops.push_back({'E', n - suffix + i, m - suffix + i});
+        ops.push_back({'E', old_hi + i, new_hi + i});
+}
+
+static std::vector<EditOp> patience_diff(
+    std::span<const std::string_view> old_lines,
+    std::span<const std::string_view> new_lines)
+{
+    PatienceState st;
+    st.old_lines = old_lines;
+    st.new_lines = new_lines;
+    st.old_ids.reserve(old_lines.size());
+    st.new_ids.reserve(new_lines.size());
+
+    // Global occurrence table: one hash lookup per line for the whole diff.
+    std::unordered_map<std::string_view, ptrdiff_t> intern;
+    for (auto line : old_lines)
+        st.old_ids.push_back(intern.try_emplace(line, std::ssize(intern)).first->second);
+    for (auto line : new_lines)
+        st.new_ids.push_back(intern.try_emplace(line, std::ssize(intern)).first->second);
+    st.old_count.assign(intern.size(), 0);
+    st.new_count.assign(intern.size(), 0);
+    st.new_pos.assign(intern.size(), -1);
 
+    std::vector<EditOp> ops;
+    patience_range(st, 0, std::ssize(old_lines), 0, std::ssize(new_lines), ops);
     return ops;
 }
 
@@ -2531,6 +2923,22 @@ DiffResult builtin_diff(std::string_view old_path, std::string_view new_path,
         new_content = fs_read(new_path);
     }
 
+    // Use labels or default to paths
+    std::string_view old_lbl = old_label.empty() ? old_path : old_label;
+    std::string_view new_lbl = new_label.empty() ? new_path : new_label;
+
+    return builtin_diff_buffers(old_content, new_content, context_lines,
+                                old_lbl, new_lbl, format, algorithm);
+}
+
+DiffResult builtin_diff_buffers(std::string_view old_content,
+                                std::string_view new_content,
+                                int context_lines,
+                                std::string_view old_lbl,
+                                std::string_view new_lbl,
+                                DiffFormat format,
+                                DiffAlgorithm algorithm)
+{
     // Split into lines
     auto old_fl = split_file_lines(old_content);
     auto new_fl = split_file_lines(new_content);
@@ -2583,10 +2991,6 @@ DiffResult builtin_diff(std::string_view old_path, std::string_view new_path,
         }
     }
 
-    // Use labels or default to paths
-    std::string old_lbl = old_label.empty() ? std::string(old_path) : std::string(old_label);
-    std::string new_lbl = new_label.empty() ? std::string(new_path) : std::string(new_label);
-
     // Build hunks
     auto hunks = build_hunks(ops, context_lines);
 
@@ -2617,27 +3021,51 @@ DiffResult builtin_diff(std::string_view old_path, std::string_view new_path,
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <unordered_map>
 
 // ── Patch parsing data structures ──────────────────────────────────────
 
+// Parsed structures view the patch text rather than copying it, so they
+// must not outlive the text passed to parse_patch.
+struct HunkLine {
+    char prefix;            // ' ', '+' or '-' (already swapped when reversed)
+    std::string_view text;  // line content without the prefix
+};
+
 struct PatchHunk {
     ptrdiff_t old_start = 0;  // 1-based line from @@ header
     ptrdiff_t old_count = 0;
     ptrdiff_t new_start = 0;
     ptrdiff_t new_count = 0;
-    std::vector<std::string> lines;  // prefixed with ' ', '+', '-'
+    std::vector<HunkLine> lines;
     // Flags for "\ No newline at end of file" on old/new side
     bool old_no_newline = false;
     bool new_no_newline = false;
 };
 
+// One hunk of a GIT binary patch, still base85-encoded and compressed.
+struct BinaryHunk {
+    bool delta = false;       // git delta against the old file, else literal
+    ptrdiff_t size = -1;      // uncompressed size; -1 when absent
+    std::vector<std::string_view> lines;
+};
+
 struct PatchFile {
     std::string old_path;
     std::string new_path;
     std::string target_path;   // after strip-level
     bool is_creation = false;  // old = /dev/null
     bool is_deletion = false;  // new = /dev/null
+    // git rename/copy: content is read from source_path, not target_path
+    std::string source_path;
+    bool keep_source = false;  // copy: source_path stays in place
+    bool drop_target = false;  // reversed copy: target_path goes away
     std::vector<PatchHunk> hunks;
+    // GIT binary patch: the hunk for the requested direction, and the
+    // (possibly abbreviated) blob ids from the index line, old then new
+    bool is_binary = false;
+    BinaryHunk binary;
+    std::string_view old_id, new_id;
 };
 
 // ── Path stripping ─────────────────────────────────────────────────────
@@ -2679,6 +3107,52 @@ static std::string extract_path(std::string_view line)
     return std::string(rest);
 }
 
+// Split the names on a "diff --git" line and strip them.  Names may hold
+// spaces, so prefer the split where both sides name the same file (or
+// the old side is the quilt -p0 ".orig" label).
+std::pair<std::string, std::string> git_diff_names(std::string_view rest, int strip)
+{
+    while (!rest.empty() && (rest.back() == ' ' || rest.back() == '\r')) {
+        rest.remove_suffix(1);
+    }
+    ptrdiff_t first = str_find(rest, ' ');
+    for (ptrdiff_t sp = first; sp >= 0; sp = str_find(rest, ' ', sp + 1)) {
+        std::string old_name = strip_path(rest.substr(0, checked_cast<size_t>(sp)), strip);
+        std::string new_name = strip_path(rest.substr(checked_cast<size_t>(sp) + 1), strip);
+        if (old_name == new_name || old_name == new_name + ".orig") {
+            return {std::move(old_name), std::move(new_name)};
+        }
+    }
+    if (first < 0) return {};
+    return {strip_path(rest.substr(0, checked_cast<size_t>(first)), strip),
+            strip_path(rest.substr(checked_cast<size_t>(first) + 1), strip)};
+}
+
+// Read one "literal N" or "delta N" hunk of a GIT binary patch, which
+// runs to the next empty line.
+static BinaryHunk parse_binary_hunk(std::span<const std::string_view> lines, ptrdiff_t &i)
+{
+    BinaryHunk hunk;
+    ptrdiff_t n = std::ssize(lines);
+    if (i >= n) return hunk;
+    std::string_view hdr = lines[checked_cast<size_t>(i)];
+    if (hdr.starts_with("literal ")) {
+        hunk.size = parse_int(hdr.substr(8));
+    } else if (hdr.starts_with("delta ")) {
+        hunk.delta = true;
+        hunk.size = parse_int(hdr.substr(6));
+    } else {
+        return hunk;
+    }
+    for (++i; i < n && !lines[checked_cast<size_t>(i)].empty(); ++i) {
+        std::string_view ln = lines[checked_cast<size_t>(i)];
+        if (ln.back() == '\r') ln.remove_suffix(1);
+        hunk.lines.push_back(ln);
+    }
+    if (i < n) ++i;  // blank line ending the hunk
+    return hunk;
+}
+
 // ── Unified diff parser ────────────────────────────────────────────────
 
 // Parse a complete unified diff into a list of per-file patch descriptions.
@@ -2686,11 +3160,110 @@ static std::vector<PatchFile> parse_patch(std::string_view text, int strip_level
                                            bool reverse)
 {
     std::vector<PatchFile> files;
-    auto lines = split_lines(text);
+    auto lines = split_line_views(text);
     ptrdiff_t n = std::ssize(lines);
     ptrdiff_t i = 0;
 
+    // Names from a git "rename from/to" or "copy from/to" header, pending
+    // until the ---/+++ pair (if any) that follows it.  Like git apply,
+    // these names have no a/ b/ prefix, so they strip one level less.
+    std::string_view git_from, git_to;
+    bool git_copy = false;
+    int git_strip = strip_level > 0 ? strip_level - 1 : strip_level;
+
+    auto set_git_names = [&](PatchFile &pf) {
+        std::string from = strip_path(git_from, git_strip);
+        std::string to = strip_path(git_to, git_strip);
+        if (!git_copy) {
+            if (reverse) std::swap(from, to);
+            pf.source_path = std::move(from);
+            pf.target_path = std::move(to);
+        } else if (!reverse) {
+            pf.source_path = std::move(from);
+            pf.target_path = std::move(to);
+            pf.keep_source = true;
+        } else {
+            // Undoing a copy: check the copy against the patch, then drop it
+            pf.target_path = std::move(to);
+            pf.drop_target = true;
+        }
+        git_from = git_to = {};
+        git_copy = false;
+    };
+
     while (i < n) {
+        if (lines[checked_cast<size_t>(i)].starts_with("diff --git ")) {
+            std::string_view names = lines[checked_cast<size_t>(i)].substr(11);
+            std::string_view index;
+            bool created = false, deleted = false;
+            git_from = git_to = {};
+            git_copy = false;
+            for (++i; i < n; ++i) {
+                std::string_view ln = lines[checked_cast<size_t>(i)];
+                if (ln.starts_with("new file mode ")) {
+                    created = true;
+                } else if (ln.starts_with("deleted file mode ")) {
+                    deleted = true;
+                } else if (ln.starts_with("index ")) {
+                    index = ln.substr(6);
+                } else if (ln.starts_with("rename from ")) {
+                    git_from = ln.substr(12);
+                } else if (ln.starts_with("rename to ")) {
+                    git_to = ln.substr(10);
+                } else if (ln.starts_with("copy from ")) {
+                    git_from = ln.substr(10);
+                    git_copy = true;
+                } else if (ln.starts_with("copy to ")) {
+                    git_to = ln.substr(8);
+                    git_copy = true;
+                } else if (!ln.starts_with("old mode ") &&
+                           !ln.starts_with("new mode ") &&
+                           !ln.starts_with("similarity index ") &&
+                           !ln.starts_with("dissimilarity index ")) {
+                    break;
+                }
+            }
+            if (i < n && lines[checked_cast<size_t>(i)].starts_with("GIT binary patch")) {
+                PatchFile pf;
+                auto [old_name, new_name] = git_diff_names(names, strip_level);
+                pf.old_path = std::move(old_name);
+                pf.new_path = new_name;
+                pf.target_path = std::move(new_name);
+                pf.is_creation = reverse ? deleted : created;
+                pf.is_deletion = reverse ? created : deleted;
+                if (!git_to.empty()) set_git_names(pf);
+
+                // "index <old>..<new>[ <mode>]"
+                index = index.substr(0, index.find(' '));
+                if (auto dots = index.find(".."); dots != std::string_view::npos) {
+                    pf.old_id = index.substr(0, dots);
+                    pf.new_id = index.substr(dots + 2);
+                    if (reverse) std::swap(pf.old_id, pf.new_id);
+                }
+
+                ++i;
+                BinaryHunk forward = parse_binary_hunk(lines, i);
+                BinaryHunk backward = parse_binary_hunk(lines, i);
+                pf.is_binary = true;
+                pf.binary = std::move(reverse ? backward : forward);
+                files.push_back(std::move(pf));
+                continue;
+            }
+            if (git_from.empty() || git_to.empty()) {
+                git_from = git_to = {};
+                continue;
+            }
+            // A pure rename or copy has no ---/+++ pair and no hunks
+            if (i + 1 >= n || !lines[checked_cast<size_t>(i)].starts_with("--- ") ||
+                !lines[checked_cast<size_t>(i + 1)].starts_with("+++ ")) {
+                PatchFile pf;
+                set_git_names(pf);
+                pf.old_path = pf.new_path = pf.target_path;
+                files.push_back(std::move(pf));
+            }
+            continue;
+        }
+
         // Look for "--- " header
         if (!lines[checked_cast<size_t>(i)].starts_with("--- ")) {
             ++i;
@@ -2736,6 +3309,7 @@ static std::vector<PatchFile> parse_patch(std::string_view text, int strip_level
                 pf.target_path = stripped_old;
             }
         }
+        if (!git_to.empty()) set_git_names(pf);
 
         i += 2;  // skip --- and +++ lines
 
@@ -2801,7 +3375,7 @@ static std::vector<PatchFile> parse_patch(std::string_view text, int strip_level
                     if (!hunk.lines.empty()) {
                         // Prefixes are already swapped if reverse=true, so
                         // '-' is always the old side and '+' the new side.
-                        char prev_prefix = hunk.lines.back()[0];
+                        char prev_prefix = hunk.lines.back().prefix;
                         if (prev_prefix == '-')
                             hunk.old_no_newline = true;
                         else if (prev_prefix == '+')
@@ -2816,8 +3390,7 @@ static std::vector<PatchFile> parse_patch(std::string_view text, int strip_level
                 if (ln.empty()) {
                     // Empty line in diff = context line (space was stripped)
                     if (old_seen >= hunk.old_count && new_seen >= hunk.new_count) break;
-                    std::string line_str = " ";
-                    hunk.lines.push_back(line_str);
+                    hunk.lines.push_back({' ', {}});
                     old_seen++;
                     new_seen++;
                     ++i;
@@ -2826,19 +3399,16 @@ static std::vector<PatchFile> parse_patch(std::string_view text, int strip_level
 
                 char prefix = ln[0];
                 if (prefix == ' ' || prefix == '-' || prefix == '+') {
-                    std::string line_str(ln);
-
                     if (reverse) {
-                        if (prefix == '-') line_str[0] = '+';
-                        else if (prefix == '+') line_str[0] = '-';
+                        if (prefix == '-') prefix = '+';
+                        else if (prefix == '+') prefix = '-';
                     }
 
-                    char actual_prefix = line_str[0];
-                    if (actual_prefix == ' ') {
+                    if (prefix == ' ') {
                         if (old_seen >= hunk.old_count && new_seen >= hunk.new_count) break;
                         old_seen++;
                         new_seen++;
-                    } else if (actual_prefix == '-') {
+                    } else if (prefix == '-') {
                         if (old_seen >= hunk.old_count) break;
                         old_seen++;
                     } else { // '+'
@@ -2846,7 +3416,7 @@ static std::vector<PatchFile> parse_patch(std::string_view text, int strip_level
                         new_seen++;
                     }
 
-                    hunk.lines.push_back(std::move(line_str));
+                    hunk.lines.push_back({prefix, ln.substr(1)});
                     ++i;
                 } else {
                     // Start of next file section or unknown line
@@ -2863,12 +3433,26 @@ static std::vector<PatchFile> parse_patch(std::string_view text, int strip_level
     return files;
 }
 
+// The (source, target) names of every git rename and copy in a patch.
+std::vector<std::pair<std::string, std::string>>
+git_renames(std::string_view patch_text, int strip_level)
+{
+    std::vector<std::pair<std::string, std::string>> renames;
+    for (auto &pf : parse_patch(patch_text, strip_level, false)) {
+        if (!pf.source_path.empty() && pf.source_path != pf.target_path) {
+            renames.emplace_back(std::move(pf.source_path), std::move(pf.target_path));
+        }
+    }
+    return renames;
+}
+
 // ── Line-based file representation ─────────────────────────────────────
 
 // Split file content into lines.  Each line does NOT include its trailing '\n'.
-// Returns whether the file had a trailing newline.
+// Returns whether the file had a trailing newline.  The lines view the
+// content, which the caller keeps alive.
 struct FileContent {
-    std::vector<std::string> lines;
+    std::vector<std::string_view> lines;
     bool has_trailing_newline = true;
     bool crlf = false;  // true if original file used \r\n line endings
 };
@@ -2895,15 +3479,15 @@ static FileContent load_file_lines(std::string_view content)
             ptrdiff_t end = i;
             if (end > start && content[checked_cast<size_t>(end - 1)] == '\r')
                 --end;
-            fc.lines.emplace_back(content.substr(checked_cast<size_t>(start), checked_cast<size_t>(end - start)));
+            fc.lines.push_back(content.substr(checked_cast<size_t>(start), checked_cast<size_t>(end - start)));
             start = i + 1;
         }
     }
     if (start < len) {
-        std::string tail(content.substr(checked_cast<size_t>(start), checked_cast<size_t>(len - start)));
+        std::string_view tail = content.substr(checked_cast<size_t>(start), checked_cast<size_t>(len - start));
         if (!tail.empty() && tail.back() == '\r')
-            tail.pop_back();
-        fc.lines.push_back(std::move(tail));
+            tail.remove_suffix(1);
+        fc.lines.push_back(tail);
     }
 
     return fc;
@@ -2922,13 +3506,10 @@ static std::vector<PatternLine> get_old_pattern(const PatchHunk &hunk)
 {
     std::vector<PatternLine> pattern;
     for (const auto &line : hunk.lines) {
-        char prefix = line[0];
-        std::string_view text(line);
-        text = text.substr(1);
-        if (prefix == ' ') {
-            pattern.push_back({text, true});
-        } else if (prefix == '-') {
-            pattern.push_back({text, false});
+        if (line.prefix == ' ') {
+            pattern.push_back({line.text, true});
+        } else if (line.prefix == '-') {
+            pattern.push_back({line.text, false});
         }
         // '+' lines are not part of the old-side pattern
     }
@@ -2954,59 +3535,89 @@ static HunkContext get_hunk_context(const PatchHunk &hunk)
 {
     HunkContext ctx;
     for (const auto &line : hunk.lines) {
-        if (line[0] == ' ') ++ctx.prefix;
+        if (line.prefix == ' ') ++ctx.prefix;
         else break;
     }
     for (auto it = hunk.lines.rbegin(); it != hunk.lines.rend(); ++it) {
-        if ((*it)[0] == ' ') ++ctx.suffix;
+        if (it->prefix == ' ') ++ctx.suffix;
         else break;
     }
     return ctx;
 }
 
-// Try to match a hunk's old-side pattern against file lines starting at
-// position `pos` (0-based), with `fuzz` context lines skipped at top/bottom.
-// prefix_ctx/suffix_ctx are the real context extents from the full hunk.
-// Returns true if the pattern matches.
-static bool try_match(std::span<const std::string> file_lines,
+// Compare a hunk's old-side pattern against the file lines at position
+// `pos` (0-based) once, and return the smallest fuzz level <= max_fuzz at
+// which it matches, or -1.  Fuzz f skips min(f, prefix_ctx) context lines
+// at the top and min(f, suffix_ctx) at the bottom; prefix_ctx/suffix_ctx
+// are the real context extents from the full hunk.  Lines that no allowed
+// fuzz level may skip must all match.  The level then follows from the
+// last mismatching line in the leading edge and the first one in the
+// trailing edge.
+static int match_fuzz(std::span<const std::string_view> file_lines,
                       ptrdiff_t pos,
                       const std::vector<PatternLine> &pattern,
-                      int fuzz,
+                      int max_fuzz,
                       ptrdiff_t prefix_ctx,
                       ptrdiff_t suffix_ctx)
 {
     ptrdiff_t pat_len = std::ssize(pattern);
-    if (pat_len == 0) return true;
-
-    ptrdiff_t prefix_fuzz = std::min(static_cast<ptrdiff_t>(fuzz), prefix_ctx);
-    ptrdiff_t suffix_fuzz = std::min(static_cast<ptrdiff_t>(fuzz), suffix_ctx);
+    ptrdiff_t file_len = std::ssize(file_lines);
+    ptrdiff_t max_prefix = std::min(static_cast<ptrdiff_t>(max_fuzz), prefix_ctx);
+    ptrdiff_t max_suffix = std::min(static_cast<ptrdiff_t>(max_fuzz), suffix_ctx);
 
-    // Lines to match: skip prefix_fuzz from top, suffix_fuzz from bottom
-    ptrdiff_t match_start = prefix_fuzz;
-    ptrdiff_t match_end = pat_len - suffix_fuzz;
+    auto line_matches = [&](ptrdiff_t j) {
+        ptrdiff_t file_pos = pos + j;
+        return file_pos >= 0 && file_pos < file_len &&
+               file_lines[checked_cast<size_t>(file_pos)] == pattern[checked_cast<size_t>(j)].text;
+    };
+    // An empty window matches anywhere up to the end of the file.
+    auto level = [&](int fuzz) {
+        ptrdiff_t window = pat_len - std::min(static_cast<ptrdiff_t>(fuzz), prefix_ctx)
+                                   - std::min(static_cast<ptrdiff_t>(fuzz), suffix_ctx);
+        return (window > 0 || pos <= file_len) ? fuzz : -1;
+    };
 
-    // Adjust file position: we start matching at pos + prefix_fuzz
-    ptrdiff_t file_pos = pos + prefix_fuzz;
-    ptrdiff_t file_len = std::ssize(file_lines);
+    if (max_prefix + max_suffix > pat_len) {
+        // Edges overlap (a hunk of pure context): test each level in turn.
+        for (int fuzz = 0; fuzz <= max_fuzz; ++fuzz) {
+            ptrdiff_t start = std::min(static_cast<ptrdiff_t>(fuzz), prefix_ctx);
+            ptrdiff_t end = pat_len - std::min(static_cast<ptrdiff_t>(fuzz), suffix_ctx);
+            bool ok = true;
+            for (ptrdiff_t j = start; ok && j < end; ++j)
+                ok = line_matches(j);
+            if (ok) return level(fuzz);
+        }
+        return -1;
+    }
 
-    for (ptrdiff_t j = match_start; j < match_end; ++j) {
-        if (file_pos < 0 || file_pos >= file_len) return false;
-        if (file_lines[checked_cast<size_t>(file_pos)] != pattern[checked_cast<size_t>(j)].text) return false;
-        ++file_pos;
+    for (ptrdiff_t j = max_prefix; j < pat_len - max_suffix; ++j) {
+        if (!line_matches(j)) return -1;
     }
 
-    return true;
+    ptrdiff_t need = 0;
+    for (ptrdiff_t j = max_prefix - 1; j >= 0; --j) {
+        if (!line_matches(j)) { need = j + 1; break; }
+    }
+    for (ptrdiff_t j = pat_len - max_suffix; j < pat_len; ++j) {
+        if (!line_matches(j)) { need = std::max(need, pat_len - j); break; }
+    }
+    return level(checked_cast<int>(need));
 }
 
 // Spiral search: find where a hunk matches in the file.
-// Returns the 0-based file position, or -1 if not found.
-// Updates cumulative_offset on success.
-static ptrdiff_t locate_hunk(std::span<const std::string> file_lines,
+// Returns the 0-based file position, or -1 if not found, and sets
+// fuzz_used to the fuzz level of the match.
+// Every candidate position is compared once; the result is the first
+// position in spiral order among those with the lowest fuzz level, which
+// is the order patch(1) tries them in (all positions at fuzz 0, then all
+// at fuzz 1, and so on).
+static ptrdiff_t locate_hunk(std::span<const std::string_view> file_lines,
                               const PatchHunk &hunk,
                               const std::vector<PatternLine> &pattern,
                               ptrdiff_t last_frozen_line,
                               ptrdiff_t cumulative_offset,
-                              int max_fuzz)
+                              int max_fuzz,
+                              int &fuzz_used)
 {
     ptrdiff_t file_len = std::ssize(file_lines);
     ptrdiff_t pat_old_count = std::ssize(pattern);
@@ -3017,52 +3628,42 @@ static ptrdiff_t locate_hunk(std::span<const std::string> file_lines,
     // First guess: hunk header's old_start (1-based) converted to 0-based + offset
     ptrdiff_t first_guess = hunk.old_start - 1 + cumulative_offset;
 
-    // Clamp to valid range
-    ptrdiff_t max_pos = file_len - pat_old_count;
-    if (max_pos < 0) max_pos = 0;
-
-    for (int fuzz = 0; fuzz <= max_fuzz; ++fuzz) {
-        ptrdiff_t prefix_fuzz = std::min(static_cast<ptrdiff_t>(fuzz), ctx.prefix);
-        ptrdiff_t suffix_fuzz = std::min(static_cast<ptrdiff_t>(fuzz), ctx.suffix);
-        ptrdiff_t effective_pat_len = pat_old_count - prefix_fuzz - suffix_fuzz;
-
-        ptrdiff_t max_search = file_len - effective_pat_len;
-        if (effective_pat_len == 0) max_search = file_len;  // empty pattern matches anywhere
-
-        // Try exact position first
-        if (first_guess >= 0 && first_guess <= max_search &&
-            first_guess > last_frozen_line - 1) {
-            if (try_match(file_lines, first_guess, pattern, fuzz, ctx.prefix, ctx.suffix)) {
-                return first_guess;
-            }
-        }
+    // Last position at which the lines compared at the highest fuzz level
+    // still fit in the file; lower levels are rejected by match_fuzz.
+    ptrdiff_t effective_pat_len = pat_old_count
+        - std::min(static_cast<ptrdiff_t>(max_fuzz), ctx.prefix)
+        - std::min(static_cast<ptrdiff_t>(max_fuzz), ctx.suffix);
+    ptrdiff_t max_search = file_len - effective_pat_len;
+    if (effective_pat_len == 0) max_search = file_len;  // empty pattern matches anywhere
+
+    ptrdiff_t best_pos = -1;
+    int best_fuzz = max_fuzz + 1;
+
+    // Returns true once no better position can exist (an exact match).
+    auto consider = [&](ptrdiff_t pos) {
+        if (pos < 0 || pos > max_search || pos <= last_frozen_line - 1) return false;
+        int fuzz = match_fuzz(file_lines, pos, pattern, best_fuzz - 1,
+                              ctx.prefix, ctx.suffix);
+        if (fuzz < 0) return false;
+        best_pos = pos;
+        best_fuzz = fuzz;
+        return fuzz == 0;
+    };
 
-        // Spiral outward
+    // Try exact position first, then spiral outward
+    if (!consider(first_guess)) {
         ptrdiff_t max_offset_forward = max_search - first_guess;
         ptrdiff_t max_offset_backward = first_guess - last_frozen_line;
         ptrdiff_t max_range = std::max(max_offset_forward, max_offset_backward);
-        if (max_range < 0) max_range = 0;
 
         for (ptrdiff_t delta = 1; delta <= max_range; ++delta) {
-            // Try forward
-            ptrdiff_t pos = first_guess + delta;
-            if (pos >= 0 && pos <= max_search && pos > last_frozen_line - 1) {
-                if (try_match(file_lines, pos, pattern, fuzz, ctx.prefix, ctx.suffix)) {
-                    return pos;
-                }
-            }
-
-            // Try backward
-            pos = first_guess - delta;
-            if (pos >= 0 && pos <= max_search && pos > last_frozen_line - 1) {
-                if (try_match(file_lines, pos, pattern, fuzz, ctx.prefix, ctx.suffix)) {
-                    return pos;
-                }
-            }
+            if (consider(first_guess + delta)) break;
+            if (consider(first_guess - delta)) break;
         }
     }
 
-    return -1;  // no match found
+    fuzz_used = best_pos >= 0 ? best_fuzz : 0;
+    return best_pos;
 }
 
 // ── Hunk application ───────────────────────────────────────────────────
@@ -3072,9 +3673,8 @@ static std::vector<std::string_view> get_new_lines(const PatchHunk &hunk)
 {
     std::vector<std::string_view> result;
     for (const auto &line : hunk.lines) {
-        char prefix = line[0];
-        if (prefix == ' ' || prefix == '+') {
-            result.push_back(std::string_view(line).substr(1));
+        if (line.prefix == ' ' || line.prefix == '+') {
+            result.push_back(line.text);
         }
     }
     return result;
@@ -3083,7 +3683,7 @@ static std::vector<std::string_view> get_new_lines(const PatchHunk &hunk)
 // Build the output file content after applying all successfully matched hunks.
 // hunks_positions[i] = 0-based file position where hunk i matched, or -1 if rejected.
 // hunk_fuzz[i] = fuzz amounts used for hunk i (to trim context from both sides).
-static std::string build_output(std::span<const std::string> file_lines,
+static std::string build_output(std::span<const std::string_view> file_lines,
                                  bool has_trailing_newline,
                                  const PatchFile &pf,
                                  const std::vector<ptrdiff_t> &hunk_positions,
@@ -3158,7 +3758,10 @@ static std::string build_output(std::span<const std::string> file_lines,
 
 // Build output with merge conflict markers for rejected hunks.
 // Applies successful hunks normally, inserts conflict markers for failed ones.
-static std::string build_merge_output(std::span<const std::string> file_lines,
+// A changed region the file already matches gets no markers.  Without the
+// diff3 base section, conflicts are further split at the lines the file and
+// the patch agree on, so each block holds only the lines that differ.
+static std::string build_merge_output(std::span<const std::string_view> file_lines,
                                        bool has_trailing_newline,
                                        const PatchFile &pf,
                                        const std::vector<ptrdiff_t> &hunk_positions,
@@ -3171,6 +3774,26 @@ static std::string build_merge_output(std::span<const std::string> file_lines,
     ptrdiff_t file_len = std::ssize(file_lines);
     ptrdiff_t last_copied = 0;
 
+    auto emit = [&](std::span<const std::string_view> lines) {
+        for (std::string_view line : lines) {
+            output += line;
+            output += '\n';
+        }
+    };
+    auto emit_conflict = [&](std::span<const std::string_view> ours,
+                             std::span<const std::string_view> base,
+                             std::span<const std::string_view> theirs) {
+        output += "<<<<<<<\n";
+        emit(ours);
+        if (merge_style == "diff3") {
+            output += "|||||||\n";
+            emit(base);
+        }
+        output += "=======\n";
+        emit(theirs);
+        output += ">>>>>>>\n";
+    };
+
     // Process all hunks in order
     for (ptrdiff_t h = 0; h < std::ssize(pf.hunks); ++h) {
         const auto &hunk = pf.hunks[checked_cast<size_t>(h)];
@@ -3228,7 +3851,7 @@ static std::string build_merge_output(std::span<const std::string> file_lines,
             ptrdiff_t hunk_len = std::ssize(hunk.lines);
 
             while (hi < hunk_len) {
-                char prefix = hunk.lines[checked_cast<size_t>(hi)][0];
+                char prefix = hunk.lines[checked_cast<size_t>(hi)].prefix;
 
                 if (prefix == ' ') {
                     // Context line — emit the file's actual line
@@ -3241,41 +3864,47 @@ static std::string build_merge_output(std::span<const std::string> file_lines,
                 } else {
                     // Changed region — collect contiguous -/+ lines
                     std::vector<std::string_view> old_lines, new_change;
-                    while (hi < hunk_len && hunk.lines[checked_cast<size_t>(hi)][0] == '-') {
-                        old_lines.push_back(std::string_view(hunk.lines[checked_cast<size_t>(hi)]).substr(1));
+                    while (hi < hunk_len && hunk.lines[checked_cast<size_t>(hi)].prefix == '-') {
+                        old_lines.push_back(hunk.lines[checked_cast<size_t>(hi)].text);
                         ++hi;
                     }
-                    while (hi < hunk_len && hunk.lines[checked_cast<size_t>(hi)][0] == '+') {
-                        new_change.push_back(std::string_view(hunk.lines[checked_cast<size_t>(hi)]).substr(1));
+                    while (hi < hunk_len && hunk.lines[checked_cast<size_t>(hi)].prefix == '+') {
+                        new_change.push_back(hunk.lines[checked_cast<size_t>(hi)].text);
                         ++hi;
                     }
 
-                    output += "<<<<<<<\n";
-
                     // Current file content for the old-side span
                     ptrdiff_t span = std::ssize(old_lines);
                     ptrdiff_t end = file_pos + span;
                     if (end > file_len) end = file_len;
-                    for (ptrdiff_t j = file_pos; j < end; ++j) {
-                        output += file_lines[checked_cast<size_t>(j)];
-                        output += '\n';
-                    }
-
-                    if (merge_style == "diff3") {
-                        output += "|||||||\n";
-                        for (const auto &ol : old_lines) {
-                            output += ol;
+                    auto ours = file_lines.subspan(checked_cast<size_t>(file_pos),
+                                                   checked_cast<size_t>(end - file_pos));
+                    std::span<const std::string_view> theirs = new_change;
+
+                    if (std::ranges::equal(ours, theirs)) {
+                        emit(ours);
+                    } else if (merge_style == "diff3") {
+                        emit_conflict(ours, old_lines, theirs);
+                    } else {
+                        ptrdiff_t oi = 0, ti = 0;  // start of the pending difference
+                        auto flush = [&](ptrdiff_t o_end, ptrdiff_t t_end) {
+                            if (o_end > oi || t_end > ti) {
+                                emit_conflict(ours.subspan(checked_cast<size_t>(oi), checked_cast<size_t>(o_end - oi)),
+                                              {},
+                                              theirs.subspan(checked_cast<size_t>(ti), checked_cast<size_t>(t_end - ti)));
+                            }
+                        };
+                        for (const auto &op : myers_diff(ours, theirs)) {
+                            if (op.type != 'E') continue;
+                            flush(op.old_idx, op.new_idx);
+                            output += ours[checked_cast<size_t>(op.old_idx)];
                             output += '\n';
+                            oi = op.old_idx + 1;
+                            ti = op.new_idx + 1;
                         }
+                        flush(std::ssize(ours), std::ssize(theirs));
                     }
 
-                    output += "=======\n";
-                    for (const auto &nl : new_change) {
-                        output += nl;
-                        output += '\n';
-                    }
-                    output += ">>>>>>>\n";
-
                     file_pos = end;
                 }
             }
@@ -3328,7 +3957,8 @@ static std::string format_rejects(const PatchFile &pf,
 
         // Write hunk lines
         for (const auto &line : hunk.lines) {
-            result += line;
+            result += line.prefix;
+            result += line.text;
             result += '\n';
         }
         if (hunk.old_no_newline) {
@@ -3339,6 +3969,362 @@ static std::string format_rejects(const PatchFile &pf,
     return result;
 }
 
+// ── Git binary patches ─────────────────────────────────────────────────
+
+// A "GIT binary patch" carries each hunk as base85 lines of zlib data.
+// The data is either the whole new file ("literal") or a git delta
+// against the old file ("delta").  Sizes are the uncompressed sizes.
+
+static uint32_t adler32(std::string_view data)
+{
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < data.size();) {
+        // 5552 bytes is the most that cannot overflow b before reducing
+        size_t end = std::min(data.size(), i + 5552);
+        for (; i < end; ++i) {
+            a += uint8_t(data[i]);
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+static std::optional<std::string> zlib_decompress(std::string_view in)
+{
+    if (in.size() < 6) return std::nullopt;
+    unsigned cmf = uint8_t(in[0]), flg = uint8_t(in[1]);
+    if ((cmf & 0x0f) != 8 || (cmf << 8 | flg) % 31 != 0 || (flg & 0x20)) {
+        return std::nullopt;
+    }
+    std::string out;
+    ptrdiff_t used = inflate_raw(in.substr(2), out);
+    if (used < 0 || 2 + used + 4 > std::ssize(in)) return std::nullopt;
+    uint32_t check = 0;
+    for (int k = 0; k < 4; ++k) {
+        check = check << 8 | uint8_t(in[checked_cast<size_t>(2 + used + k)]);
+    }
+    if (check != adler32(out)) return std::nullopt;
+    return out;
+}
+
+// Wrap data in a zlib stream of stored blocks.  Delta encoding does the
+// heavy lifting for revisions of a file; this keeps the encoder trivial.
+static std::string zlib_store(std::string_view data)
+{
+    std::string out = "\x78\x01";
+    size_t pos = 0;
+    do {
+        size_t len = std::min(data.size() - pos, size_t{65535});
+        bool last = pos + len == data.size();
+        out += char(last);
+        out += char(len & 0xff);
+        out += char(len >> 8);
+        out += char(~len & 0xff);
+        out += char(~len >> 8 & 0xff);
+        out.append(data.substr(pos, len));
+        pos += len;
+    } while (pos < data.size());
+    uint32_t check = adler32(data);
+    for (int shift = 24; shift >= 0; shift -= 8) out += char(check >> shift & 0xff);
+    return out;
+}
+
+static constexpr std::string_view base85_chars =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz!#$%&()*+-;<=>?@^_`{|}~";
+
+// Decode base85 lines, each prefixed by its byte count ('A' = 1 ...
+// 'Z' = 26, 'a' = 27 ... 'z' = 52).
+static std::optional<std::string> base85_decode(std::span<const std::string_view> lines)
+{
+    int8_t value[256];
+    std::memset(value, -1, sizeof(value));
+    for (size_t k = 0; k < base85_chars.size(); ++k) {
+        value[uint8_t(base85_chars[k])] = int8_t(k);
+    }
+
+    std::string out;
+    for (std::string_view line : lines) {
+        if (line.empty()) return std::nullopt;
+        int len;
+        if (line[0] >= 'A' && line[0] <= 'Z') len = line[0] - 'A' + 1;
+        else if (line[0] >= 'a' && line[0] <= 'z') len = line[0] - 'a' + 27;
+        else return std::nullopt;
+        std::string_view digits = line.substr(1);
+        if (std::ssize(digits) != (len + 3) / 4 * 5) return std::nullopt;
+        for (ptrdiff_t at = 0; len > 0; at += 5) {
+            uint64_t word = 0;
+            for (ptrdiff_t k = 0; k < 5; ++k) {
+                int8_t v = value[uint8_t(digits[checked_cast<size_t>(at + k)])];
+                if (v < 0) return std::nullopt;
+                word = word * 85 + uint64_t(v);
+            }
+            if (word > 0xffffffff) return std::nullopt;
+            for (int shift = 24; shift >= 0 && len > 0; shift -= 8, --len) {
+                out += char(word >> shift & 0xff);
+            }
+        }
+    }
+    return out;
+}
+
+static std::string base85_encode(std::string_view data)
+{
+    std::string out;
+    for (size_t pos = 0; pos < data.size(); pos += 52) {
+        size_t len = std::min(data.size() - pos, size_t{52});
+        out += len <= 26 ? char('A' + len - 1) : char('a' + len - 27);
+        for (size_t at = 0; at < len; at += 4) {
+            uint32_t word = 0;
+            for (size_t k = 0; k < 4; ++k) {
+                size_t i = pos + at + k;
+                word = word << 8 | (at + k < len ? uint8_t(data[i]) : 0u);
+            }
+            char digits[5];
+            for (int k = 4; k >= 0; --k) {
+                digits[k] = base85_chars[word % 85];
+                word /= 85;
+            }
+            out.append(digits, 5);
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+// Git delta format: source and result sizes as little-endian base-128
+// varints, then ops.  An op with the high bit set copies from the source;
+// its low four bits select offset bytes and the next three select size
+// bytes, with a size of zero meaning 0x10000.  Any other nonzero op
+// inserts that many literal bytes.
+static void put_varint(std::string &out, size_t v)
+{
+    for (; v >= 0x80; v >>= 7) out += char((v & 0x7f) | 0x80);
+    out += char(v);
+}
+
+static bool get_varint(std::string_view in, size_t &pos, size_t &v)
+{
+    v = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t c = uint8_t(in[pos++]);
+        v |= size_t(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+static std::optional<std::string> apply_delta(std::string_view src, std::string_view delta)
+{
+    size_t pos = 0, src_size, dst_size;
+    if (!get_varint(delta, pos, src_size) || src_size != src.size() ||
+        !get_varint(delta, pos, dst_size)) {
+        return std::nullopt;
+    }
+    std::string out;
+    out.reserve(dst_size);
+    while (pos < delta.size()) {
+        uint8_t op = uint8_t(delta[pos++]);
+        if (op & 0x80) {
+            size_t off = 0, len = 0;
+            for (int k = 0; k < 7; ++k) {
+                if (!(op & 1 << k)) continue;
+                if (pos >= delta.size()) return std::nullopt;
+                size_t byte = uint8_t(delta[pos++]);
+                if (k < 4) off |= byte << 8 * k;
+                else len |= byte << 8 * (k - 4);
+            }
+            if (len == 0) len = 0x10000;
+            if (off > src.size() || len > src.size() - off) return std::nullopt;
+            out.append(src.substr(off, len));
+        } else if (op) {
+            if (op > delta.size() - pos) return std::nullopt;
+            out.append(delta.substr(pos, op));
+            pos += op;
+        } else {
+            return std::nullopt;
+        }
+        if (out.size() > dst_size) return std::nullopt;
+    }
+    if (out.size() != dst_size) return std::nullopt;
+    return out;
+}
+
+// Build a delta from src to dst.  Every block of the source is indexed by
+// a rolling hash; sliding the same hash along dst finds candidate matches,
+// which are verified and then grown in both directions.
+static std::string make_delta(std::string_view src, std::string_view dst)
+{
+    constexpr ptrdiff_t window = 16;
+    constexpr uint32_t mult = 0x01000193;
+    uint32_t drop = 1;  // mult^(window-1), to remove the outgoing byte
+    for (ptrdiff_t k = 1; k < window; ++k) drop *= mult;
+    auto hash_at = [&](std::string_view s, ptrdiff_t at) {
+        uint32_t h = 0;
+        for (ptrdiff_t k = 0; k < window; ++k) h = h * mult + uint8_t(s[checked_cast<size_t>(at + k)]);
+        return h;
+    };
+
+    std::unordered_map<uint32_t, ptrdiff_t> index;
+    index.reserve(src.size() / window + 1);
+    for (ptrdiff_t at = 0; at + window <= std::ssize(src); at += window) {
+        index.try_emplace(hash_at(src, at), at);
+    }
+
+    std::string out;
+    put_varint(out, src.size());
+    put_varint(out, dst.size());
+    auto insert = [&](ptrdiff_t from, ptrdiff_t to) {
+        for (; from < to; from += 127) {
+            ptrdiff_t len = std::min(to - from, ptrdiff_t{127});
+            out += char(len);
+            out.append(dst.substr(checked_cast<size_t>(from), checked_cast<size_t>(len)));
+        }
+    };
+    auto copy = [&](ptrdiff_t off, ptrdiff_t len) {
+        for (; len > 0;) {
+            ptrdiff_t part = std::min(len, ptrdiff_t{0x10000});
+            std::string op(1, '\x80');
+            for (int k = 0; k < 4; ++k) {
+                if (uint8_t b = uint8_t(off >> 8 * k)) {
+                    op[0] = char(op[0] | 1 << k);
+                    op += char(b);
+                }
+            }
+            for (int k = 0; k < 3 && part < 0x10000; ++k) {
+                if (uint8_t b = uint8_t(part >> 8 * k)) {
+                    op[0] = char(op[0] | 1 << (4 + k));
+                    op += char(b);
+                }
+            }
+            out += op;
+            off += part;
+            len -= part;
+        }
+    };
+
+    ptrdiff_t pending = 0;  // start of bytes not yet emitted
+    ptrdiff_t at = 0;
+    ptrdiff_t end = std::ssize(dst);
+    uint32_t h = at + window <= end ? hash_at(dst, at) : 0;
+    while (at + window <= end) {
+        auto it = index.find(h);
+        if (it != index.end() &&
+            src.substr(checked_cast<size_t>(it->second), window) ==
+            dst.substr(checked_cast<size_t>(at), window)) {
+            ptrdiff_t off = it->second, len = window;
+            while (off + len < std::ssize(src) && at + len < end &&
+                   src[checked_cast<size_t>(off + len)] == dst[checked_cast<size_t>(at + len)]) {
+                ++len;
+            }
+            while (at > pending && off > 0 &&
+                   src[checked_cast<size_t>(off - 1)] == dst[checked_cast<size_t>(at - 1)]) {
+                --at;
+                --off;
+                ++len;
+            }
+            insert(pending, at);
+            copy(off, len);
+            at += len;
+            pending = at;
+            if (at + window <= end) h = hash_at(dst, at);
+            continue;
+        }
+        if (at + window < end) {
+            h = (h - uint8_t(dst[checked_cast<size_t>(at)]) * drop) * mult +
+                uint8_t(dst[checked_cast<size_t>(at + window)]);
+        }
+        ++at;
+    }
+    insert(pending, end);
+    return out;
+}
+
+// SHA-1 (FIPS 180-4), for git object ids.
+static std::string sha1_hex(std::string_view data)
+{
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    auto rol = [](uint32_t x, int n) { return x << n | x >> (32 - n); };
+    auto block = [&](const uint8_t *p) {
+        uint32_t w[80];
+        for (int t = 0; t < 16; ++t) {
+            w[t] = uint32_t(p[4*t]) << 24 | uint32_t(p[4*t + 1]) << 16 |
+                   uint32_t(p[4*t + 2]) << 8 | uint32_t(p[4*t + 3]);
+        }
+        for (int t = 16; t < 80; ++t) w[t] = rol(w[t-3] ^ w[t-8] ^ w[t-14] ^ w[t-16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int t = 0; t < 80; ++t) {
+            uint32_t f, k;
+            if (t < 20)      { f = (b & c) | (~b & d);          k = 0x5a827999; }
+            else if (t < 40) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+            else if (t < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else             { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+            uint32_t tmp = rol(a, 5) + f + e + k + w[t];
+            e = d; d = c; c = rol(b, 30); b = a; a = tmp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    };
+
+    size_t full = data.size() / 64 * 64;
+    for (size_t i = 0; i < full; i += 64) {
+        block(reinterpret_cast<const uint8_t *>(data.data() + i));
+    }
+    uint8_t tail[128] = {};
+    size_t rest = data.size() - full;
+    std::memcpy(tail, data.data() + full, rest);
+    tail[rest] = 0x80;
+    size_t tail_len = rest < 56 ? 64 : 128;
+    uint64_t bits = uint64_t(data.size()) * 8;
+    for (size_t k = 0; k < 8; ++k) {
+        tail[tail_len - 1 - k] = static_cast<uint8_t>(bits >> (8 * k) & 0xff);
+    }
+    block(tail);
+    if (tail_len == 128) block(tail + 64);
+
+    std::string hex;
+    for (uint32_t v : h) hex += std::format("{:08x}", v);
+    return hex;
+}
+
+std::string git_blob_id(std::string_view content)
+{
+    std::string blob = std::format("blob {}", content.size());
+    blob += '\0';
+    blob += content;
+    return sha1_hex(blob);
+}
+
+// One hunk turning from into to: a delta when that is smaller than the
+// literal file, as git does.
+static std::string git_binary_hunk(std::string_view from, std::string_view to)
+{
+    std::string delta = from.empty() ? std::string{} : make_delta(from, to);
+    bool use_delta = !from.empty() && delta.size() < to.size();
+    std::string_view payload = use_delta ? std::string_view(delta) : to;
+    return std::format("{} {}\n", use_delta ? "delta" : "literal", payload.size()) +
+           base85_encode(zlib_store(payload)) + "\n";
+}
+
+std::string git_binary_patch(std::string_view old_content, std::string_view new_content)
+{
+    return "GIT binary patch\n" + git_binary_hunk(old_content, new_content) +
+           git_binary_hunk(new_content, old_content);
+}
+
+// Decode a binary hunk and produce the new contents from the old ones.
+static std::optional<std::string> apply_binary_hunk(const BinaryHunk &hunk,
+                                                    std::string_view old_content)
+{
+    auto packed = base85_decode(hunk.lines);
+    if (!packed) return std::nullopt;
+    auto data = zlib_decompress(*packed);
+    if (!data || std::ssize(*data) != hunk.size) return std::nullopt;
+    if (hunk.delta) return apply_delta(old_content, *data);
+    return data;
+}
+
 // ── Main patch engine ──────────────────────────────────────────────────
 
 PatchResult builtin_patch(std::string_view patch_text, const PatchOptions &opts)
@@ -3377,21 +4363,91 @@ PatchResult builtin_patch(std::string_view patch_text, const PatchOptions &opts)
 
     for (const auto &pf : files) {
         if (pf.target_path.empty()) continue;
+        if (opts.only_files && !opts.only_files->contains(pf.target_path) &&
+            !opts.only_files->contains(pf.source_path)) continue;
+
+        bool renamed = !pf.source_path.empty() && pf.source_path != pf.target_path;
+        const std::string &read_path = renamed ? pf.source_path : pf.target_path;
 
         if (!opts.quiet) {
-            result.out += "patching file " + pf.target_path + "\n";
+            if (renamed) {
+                result.out += std::format("patching file {} ({} from {})\n",
+                                          pf.target_path,
+                                          pf.keep_source ? "copied" : "renamed",
+                                          pf.source_path);
+            } else {
+                result.out += "patching file " + pf.target_path + "\n";
+            }
+        }
+
+        // A rename or copy must not clobber an unrelated file
+        if (renamed && fs_exists(pf.target_path)) {
+            result.err += std::format("File {} already exists -- not {} {}\n",
+                                      pf.target_path,
+                                      pf.keep_source ? "copying" : "renaming",
+                                      pf.source_path);
+            result.exit_code = 1;
+            if (!opts.force) continue;
+        }
+
+        if (pf.is_binary) {
+            bool file_existed = fs_exists(read_path);
+            std::string old_content = file_existed ? fs_read(read_path) : std::string{};
+            std::optional<std::string> new_content;
+            auto id_matches = [](std::string_view id, std::string_view content) {
+                // All-zero ids stand for a missing file
+                if (id.empty() || id.find_first_not_of('0') == std::string_view::npos) {
+                    return true;
+                }
+                return git_blob_id(content).starts_with(id);
+            };
+            if (pf.binary.size < 0) {
+                result.err += std::format("{}: binary patch has no {} hunk\n",
+                                          pf.target_path,
+                                          opts.reverse ? "reverse" : "forward");
+            } else if (!file_existed && !pf.is_creation) {
+                result.err += "can't find file to patch at input line 0\n";
+            } else if (!id_matches(pf.old_id, old_content) ||
+                       !(new_content = apply_binary_hunk(pf.binary, old_content)) ||
+                       !id_matches(pf.new_id, *new_content)) {
+                result.err += "binary patch does not apply to " + read_path + "\n";
+                new_content.reset();
+            }
+            if (!new_content) {
+                result.exit_code = 1;
+                continue;
+            }
+            if (opts.dry_run) continue;
+
+            if (!opts.fs) {
+                std::string dir = dirname(pf.target_path);
+                if (!dir.empty() && dir != "." && !is_directory(dir)) {
+                    make_dirs(dir);
+                }
+            }
+            if (pf.is_deletion || pf.drop_target) {
+                if (file_existed) fs_delete(pf.target_path);
+            } else {
+                fs_write(pf.target_path, *new_content);
+            }
+            if (renamed && !pf.keep_source) {
+                fs_delete(pf.source_path);
+            }
+            continue;
         }
 
         // Load current file contents
+        std::string file_text;
         FileContent fc;
-        bool file_existed = fs_exists(pf.target_path);
+        bool file_existed = fs_exists(read_path);
 
         if (pf.is_creation && file_existed) {
             // File exists but patch says it should be new — still try to apply
         }
 
         if (file_existed) {
-            fc = load_file_lines(fs_read(pf.target_path));
+            file_text = fs_read(read_path);
+            fc = load_file_lines(file_text);
         } else if (!pf.is_creation) {
             // File doesn't exist and this isn't a creation patch
             result.err += "can't find file to patch at input line 0\n";
@@ -3422,9 +4478,10 @@ PatchResult builtin_patch(std::string_view patch_text, const PatchOptions &opts)
             const auto &hunk = pf.hunks[checked_cast<size_t>(h)];
             auto pattern = get_old_pattern(hunk);
 
+            int fuzz_used = 0;
             ptrdiff_t pos = locate_hunk(fc.lines, hunk, pattern,
                                          last_frozen_line, cumulative_offset,
-                                         opts.fuzz);
+                                         opts.fuzz, fuzz_used);
 
             if (pos >= 0) {
                 hunk_positions[checked_cast<size_t>(h)] = pos;
@@ -3432,17 +4489,6 @@ PatchResult builtin_patch(std::string_view patch_text, const PatchOptions &opts)
                 ptrdiff_t actual_offset = pos - (std::max(hunk.old_start, ptrdiff_t{1}) - 1);
                 auto ctx = get_hunk_context(hunk);
 
-                // Determine fuzz level used for this hunk
-                int fuzz_used = 0;
-                if (opts.fuzz > 0) {
-                    for (int f = 0; f <= opts.fuzz; ++f) {
-                        if (try_match(fc.lines, pos, pattern, f, ctx.prefix, ctx.suffix)) {
-                            fuzz_used = f;
-                            break;
-                        }
-                    }
-                }
-
                 // Record fuzz amounts for build_output trimming
                 hunk_fuzz[checked_cast<size_t>(h)] = {
                     std::min(static_cast<ptrdiff_t>(fuzz_used), ctx.prefix),
@@ -3497,7 +4543,10 @@ PatchResult builtin_patch(std::string_view patch_text, const PatchOptions &opts)
                 if (hunk_positions[checked_cast<size_t>(h)] >= 0) { any_applied = true; break; }
             }
 
-            if (any_applied || pf.is_creation || (opts.merge && file_has_rejects)) {
+            if (pf.drop_target && !file_has_rejects) {
+                fs_delete(pf.target_path);
+            } else if (any_applied || pf.is_creation || renamed ||
+                       (opts.merge && file_has_rejects)) {
                 std::string new_content;
 
                 if (opts.merge && file_has_rejects) {
@@ -3539,6 +4588,9 @@ PatchResult builtin_patch(std::string_view patch_text, const PatchOptions &opts)
                 } else {
                     fs_write(pf.target_path, new_content);
                 }
+                if (renamed && !pf.keep_source) {
+                    fs_delete(pf.source_path);
+                }
             }
 
             // Write reject file if needed (and not in merge mode)
@@ -3582,10 +4634,37 @@ static void write_applied_patches(QuiltState &q) {
 // to match what `patch -pN` would do.
 static std::vector<std::string> parse_patch_files(std::string_view content, int strip = 1) {
     std::vector<std::string> files;
-    auto lines = split_lines(content);
-    for (const auto &line : lines) {
+    // Strip N leading path components (like patch -pN)
+    auto strip_n = [](std::string f, int count) {
+        for (int i = 0; i < count && !f.empty(); ++i) {
+            ptrdiff_t slash = str_find(std::string_view(f), '/');
+            if (slash >= 0) {
+                f = f.substr(checked_cast<size_t>(slash) + 1);
+            }
+        }
+        return f;
+    };
+    bool git_names = false;  // the next +++ may repeat a rename/copy target
+    std::string_view git_line;
+    for (std::string_view line : split_line_views(content)) {
+        // git renames and copies touch both names, with or without hunks,
+        // and binary patches name their file only on the diff --git line
+        std::string f;
+        if (line.starts_with("diff --git ")) git_line = line.substr(11);
+        if (line.starts_with("rename from ")) f = strip_n(trim(line.substr(12)), strip - 1);
+        else if (line.starts_with("rename to ")) f = strip_n(trim(line.substr(10)), strip - 1);
+        else if (line.starts_with("copy to ")) f = strip_n(trim(line.substr(8)), strip - 1);
+        else if (line.starts_with("GIT binary patch")) f = git_diff_names(git_line, strip).second;
+        if (!f.empty()) {
+            if (std::ranges::find(files, f) == files.end()) {
+                files.push_back(std::move(f));
+            }
+            git_names = true;
+            continue;
+        }
+
         if (!line.starts_with("+++ ")) continue;
-        std::string_view rest = std::string_view(line).substr(4);
+        std::string_view rest = line.substr(4);
         // Skip /dev/null
         if (rest.starts_with("/dev/null")) continue;
         // Strip trailing tab and timestamp (e.g., "\t2024-01-01 ...")
@@ -3593,17 +4672,11 @@ static std::vector<std::string> parse_patch_files(std::string_view content, int
         if (tab >= 0) {
             rest = rest.substr(0, checked_cast<size_t>(tab));
         }
-        std::string f = trim(rest);
-        // Strip N leading path components (like patch -pN)
-        for (int i = 0; i < strip && !f.empty(); ++i) {
-            ptrdiff_t slash = str_find(std::string_view(f), '/');
-            if (slash >= 0) {
-                f = f.substr(checked_cast<size_t>(slash) + 1);
-            }
-        }
-        if (!f.empty()) {
+        f = strip_n(trim(rest), strip);
+        if (!f.empty() && !(git_names && std::ranges::find(files, f) != files.end())) {
             files.push_back(std::move(f));
         }
+        git_names = false;
     }
     return files;
 }
@@ -3645,11 +4718,12 @@ int cmd_series(QuiltState &q, int argc, char **argv) {
         }
     }
 
-    for (const auto &patch : q.series) {
+    for (ptrdiff_t idx = 0; idx < std::ssize(q.series); ++idx) {
+        const std::string &patch = q.series[checked_cast<size_t>(idx)];
         if (verbose) {
             if (!q.applied.empty() && patch == q.applied.back()) {
                 out("= ");
-            } else if (q.is_applied(patch)) {
+            } else if (q.is_applied_at(idx)) {
                 out("+ ");
             } else {
                 out("  ");
@@ -3659,7 +4733,7 @@ int cmd_series(QuiltState &q, int argc, char **argv) {
         if (use_color) {
             if (!q.applied.empty() && patch == q.applied.back()) {
                 out("\033[33m");  // yellow for top
-            } else if (q.is_applied(patch)) {
+            } else if (q.is_applied_at(idx)) {
                 out("\033[32m");  // green for applied
             } else {
                 out("\033[00m");  // default for unapplied
@@ -4011,7 +5085,9 @@ int cmd_push(QuiltState &q, int argc, char **argv) {
 
         // Read patch file
         std::string patch_path = path_join(q.work_dir, q.patches_dir, name);
-        std::string patch_content = read_file(patch_path);
+        auto packed_content = read_patch_file(patch_path);
+        if (!packed_content) return 1;
+        std::string patch_content = std::move(*packed_content);
         if (patch_content.empty() && !file_exists(patch_path)) {
             err_line("Patch " + display + " does not exist");
             return 1;
@@ -4075,7 +5151,7 @@ int cmd_push(QuiltState &q, int argc, char **argv) {
             }
             if (force) {
                 // Force-applied: record as applied but mark as needing refresh
-                q.applied.push_back(name);
+                q.push_applied(name);
                 write_applied_patches(q);
                 write_file(path_join(pc_dir, ".timestamp"), "");
                 write_file(path_join(pc_dir, ".needs_refresh"), "");
@@ -4101,7 +5177,7 @@ int cmd_push(QuiltState &q, int argc, char **argv) {
         }
 
         // Record as applied
-        q.applied.push_back(name);
+        q.push_applied(name);
         write_applied_patches(q);
 
         // Create .timestamp
@@ -4228,7 +5304,9 @@ int cmd_pop(QuiltState &q, int argc, char **argv) {
         // Check if patch removes cleanly (detects dirty/unrefreshed changes)
         if (!force) {
             std::string patch_path = path_join(q.work_dir, q.patches_dir, name);
-            std::string patch_content = read_file(patch_path);
+            auto read = read_patch_file(patch_path);
+            if (!read) return 1;
+            std::string patch_content = std::move(*read);
             if (!patch_content.empty()) {
                 int strip_level = q.get_strip_level(name);
                 PatchOptions verify_opts;
@@ -4272,7 +5350,7 @@ int cmd_pop(QuiltState &q, int argc, char **argv) {
         delete_dir_recursive(pc_dir);
 
         // Remove from applied list
-        q.applied.pop_back();
+        q.pop_applied();
         write_applied_patches(q);
     }
 
@@ -4315,16 +5393,13 @@ static std::string next_patch_for_file(const QuiltState &q,
                                 std::string_view patch,
                                 std::string_view file)
 {
-    bool after_target = false;
-    for (const auto &applied : q.applied) {
-        if (after_target) {
-            auto tracked = files_in_patch(q, applied);
-            if (std::ranges::find(tracked, file) != tracked.end()) {
-                return applied;
-            }
-        }
-        if (applied == patch) {
-            after_target = true;
+    auto pos = q.find_in_applied(patch);
+    if (!pos) return "";
+    for (ptrdiff_t i = *pos + 1; i < std::ssize(q.applied); ++i) {
+        const std::string &applied = q.applied[checked_cast<size_t>(i)];
+        auto tracked = files_in_patch(q, applied);
+        if (std::ranges::find(tracked, file) != tracked.end()) {
+            return applied;
         }
     }
     return "";
@@ -4491,8 +5566,7 @@ int cmd_annotate(QuiltState &q, int argc, char **argv)
 #include <cstdlib>
 #include <set>
 
-static std::string read_patch_header(std::string_view patch_path) {
-    std::string content = read_file(patch_path);
+static std::string patch_header(std::string_view content) {
     if (content.empty()) return "";
 
     std::string header;
@@ -4627,6 +5701,7 @@ int cmd_new(QuiltState &q, int argc, char **argv) {
         // Insert after the current top
         q.series.insert(q.series.begin() + top_idx + 1, patch_name);
     }
+    q.reindex();
 
     // Validate strip level
     if (!p_value.empty() && p_value != "0" && p_value != "1") {
@@ -4648,7 +5723,7 @@ int cmd_new(QuiltState &q, int argc, char **argv) {
     }
 
     // Add to applied list and write applied-patches
-    q.applied.push_back(patch_name);
+    q.push_applied(patch_name);
     std::string applied_abs = path_join(q.work_dir, q.pc_dir, "applied-patches");
     if (!write_applied(applied_abs, q.applied)) {
         err_line("Failed to write applied-patches.");
@@ -4974,6 +6049,25 @@ static bool is_placeholder_copy(std::string_view path)
     return file_exists(path) && read_file(path).empty();
 }
 
+// Binary detection: a NUL byte within the first 8 KB, the same heuristic
+// GNU diff uses.  Scans eight bytes at a time with the classic "has zero
+// byte" bit trick, then finishes the tail bytewise.
+static bool looks_binary(std::string_view data)
+{
+    ptrdiff_t len = std::min(std::ssize(data), ptrdiff_t{8192});
+    const char *p = data.data();
+    ptrdiff_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        if ((w - 0x0101010101010101u) & ~w & 0x8080808080808080u) return true;
+    }
+    for (; i < len; ++i) {
+        if (p[i] == '\0') return true;
+    }
+    return false;
+}
+
 // Parse QUILT_DIFF_OPTS and extract context line count if present.
 // Returns the context line count (-1 if not specified in opts).
 static int parse_diff_opts_context(std::span<const std::string> opts)
@@ -5003,7 +6097,111 @@ static std::string format_file_timestamp(std::string_view path) {
                        dt.hour, dt.min, dt.sec, off_h, off_m);
 }
 
-static std::string generate_path_diff(const QuiltState &q,
+// The diff of one file: output already produced by the built-in engine,
+// or an external diff command still to be run.
+struct PathDiff {
+    std::string              output;
+    std::vector<std::string> cmd;
+};
+
+// External diff output is kept unless the command reports trouble.
+static std::string external_diff_output(ProcessResult &result)
+{
+    return result.exit_code == 2 ? std::string{} : std::move(result.out);
+}
+
+static std::string path_diff_text(PathDiff diff)
+{
+    if (diff.cmd.empty()) return std::move(diff.output);
+    ProcessResult result = run_cmd(diff.cmd);
+    return external_diff_output(result);
+}
+
+// Header label for one side of a diff of `file` in the given -p format.
+static std::string diff_label(const QuiltState &q, std::string_view file,
+                              std::string_view p_format, bool old_side)
+{
+    if (p_format == "ab") {
+        return (old_side ? "a/" : "b/") + std::string(file);
+    } else if (p_format == "0") {
+        return old_side ? std::string(file) + ".orig" : std::string(file);
+    }
+    return basename(q.work_dir) + (old_side ? ".orig/" : "/") + std::string(file);
+}
+
+// Diff for a file renamed within a patch: a git header naming both paths,
+// then only the content changes, which are empty for an exact rename.
+// The rename lines carry bare file names, as git apply strips them one
+// level less than the ---/+++ labels.
+static std::string generate_rename_diff(const QuiltState &q,
+                                        std::string_view old_file,
+                                        std::string_view old_path,
+                                        std::string_view old_content,
+                                        std::string_view new_file,
+                                        std::string_view new_path,
+                                        std::string_view new_content,
+                                        int similarity,
+                                        std::string_view p_format,
+                                        int context_lines,
+                                        DiffFormat diff_format,
+                                        bool no_timestamps,
+                                        DiffAlgorithm diff_algorithm)
+{
+    std::string old_label = diff_label(q, old_file, p_format, true);
+    std::string new_label = diff_label(q, new_file, p_format, false);
+    std::string out = std::format("diff --git {} {}\n"
+                                  "similarity index {}%\n"
+                                  "rename from {}\n"
+                                  "rename to {}\n",
+                                  old_label, new_label, similarity,
+                                  old_file, new_file);
+    if (old_content == new_content) return out;
+
+    if (!no_timestamps) {
+        old_label += format_file_timestamp(old_path);
+        new_label += format_file_timestamp(new_path);
+    }
+    int ctx = context_lines;
+    int opts_ctx = parse_diff_opts_context(shell_split(get_env("QUILT_DIFF_OPTS")));
+    if (opts_ctx >= 0) ctx = opts_ctx;
+    out += builtin_diff_buffers(old_content, new_content, ctx,
+                                old_label, new_label,
+                                diff_format, diff_algorithm).output;
+    return out;
+}
+
+// GIT binary patch for a file the text diff treats as binary.  As in
+// generate_path_diff, an empty placeholder stands for a missing file.
+static std::string generate_binary_diff(const QuiltState &q,
+                                        std::string_view file,
+                                        std::string_view old_path,
+                                        std::string_view new_path,
+                                        bool new_placeholder,
+                                        std::string_view p_format)
+{
+    std::string old_content = file_exists(old_path) ? read_file(old_path) : std::string{};
+    bool old_missing = old_content.empty();
+    bool new_missing = !file_exists(new_path);
+    std::string new_content = new_missing ? std::string{} : read_file(new_path);
+    new_missing = new_missing || (new_placeholder && new_content.empty());
+    if (old_missing == new_missing && old_content == new_content) return {};
+
+    std::string out = std::format("diff --git {} {}\n",
+                                  diff_label(q, file, p_format, true),
+                                  diff_label(q, file, p_format, false));
+    if (old_missing) {
+        out += "new file mode 100644\n";
+    } else if (new_missing) {
+        out += "deleted file mode 100644\n";
+    }
+    std::string none(40, '0');
+    out += std::format("index {}..{}\n",
+                       old_missing ? none : git_blob_id(old_content),
+                       new_missing ? none : git_blob_id(new_content));
+    return out + git_binary_patch(old_content, new_content);
+}
+
+static PathDiff generate_path_diff(const QuiltState &q,
                                       std::string_view file,
                                       std::string_view old_path,
                                       bool old_placeholder,
@@ -5016,38 +6214,30 @@ static std::string generate_path_diff(const QuiltState &q,
                                       DiffFormat diff_format = DiffFormat::unified,
                                       bool no_timestamps = false,
                                       DiffAlgorithm diff_algorithm = DiffAlgorithm::myers) {
-    bool old_missing = old_path.empty() || !file_exists(old_path) ||
-        (old_placeholder && is_placeholder_copy(old_path));
-    bool new_missing = new_path.empty() || !file_exists(new_path) ||
-        (new_placeholder && is_placeholder_copy(new_path));
-
-    // Detect binary files (null bytes in first 8 KB)
-    auto is_binary = [](std::string_view path) {
-        std::string data = read_file(path);
-        size_t check_len = data.size() < 8192 ? data.size() : 8192;
-        return data.find('\0', 0) < check_len;
-    };
-    if ((!old_missing && is_binary(old_path)) ||
-        (!new_missing && is_binary(new_path))) {
-        return "Binary files differ\n";
+    // Read each side once; the placeholder test, binary detection and the
+    // built-in diff all work from these buffers.
+    std::string old_content;
+    std::string new_content;
+    bool old_missing = old_path.empty() || !file_exists(old_path);
+    if (!old_missing) {
+        old_content = read_file(old_path);
+        old_missing = old_placeholder && old_content.empty();
+    }
+    bool new_missing = new_path.empty() || !file_exists(new_path);
+    if (!new_missing) {
+        new_content = read_file(new_path);
+        new_missing = new_placeholder && new_content.empty();
+    }
+
+    if (looks_binary(old_content) || looks_binary(new_content)) {
+        return {"Binary files differ\n", {}};
     }
 
     std::string old_arg = old_missing ? "/dev/null" : std::string(old_path);
     std::string new_arg = new_missing ? "/dev/null" : std::string(new_path);
 
-    std::string old_label;
-    std::string new_label;
-    if (p_format == "ab") {
-        old_label = "a/" + std::string(file);
-        new_label = "b/" + std::string(file);
-    } else if (p_format == "0") {
-        old_label = std::string(file) + ".orig";
-        new_label = std::string(file);
-    } else {
-        std::string work_base = basename(q.work_dir);
-        old_label = work_base + ".orig/" + std::string(file);
-        new_label = work_base + "/" + std::string(file);
-    }
+    std::string old_label = diff_label(q, file, p_format, true);
+    std::string new_label = diff_label(q, file, p_format, false);
 
     if (old_missing) {
         old_label = "/dev/null";
@@ -5066,6 +6256,7 @@ static std::string generate_path_diff(const QuiltState &q,
 
     if (reverse) {
         std::swap(old_arg, new_arg);
+        std::swap(old_content, new_content);
     }
 
     // Use built-in diff when no external diff utility is specified
@@ -5076,10 +6267,10 @@ static std::string generate_path_diff(const QuiltState &q,
         int opts_ctx = parse_diff_opts_context(extra_diff_opts);
         if (opts_ctx >= 0) ctx = opts_ctx;
 
-        DiffResult result = builtin_diff(old_arg, new_arg, ctx,
-                                          old_label, new_label, diff_format,
-                                          diff_algorithm);
-        return result.output;
+        DiffResult result = builtin_diff_buffers(old_content, new_content, ctx,
+                                                 old_label, new_label,
+                                                 diff_format, diff_algorithm);
+        return {std::move(result.output), {}};
     }
 
     // External diff utility path
@@ -5095,13 +6286,7 @@ static std::string generate_path_diff(const QuiltState &q,
     cmd_argv.push_back(new_label);
     cmd_argv.push_back(old_arg);
     cmd_argv.push_back(new_arg);
-
-    ProcessResult result = run_cmd(cmd_argv);
-    if (result.exit_code == 2) {
-        return {};
-    }
-
-    return result.out;
+    return {{}, std::move(cmd_argv)};
 }
 
 static std::string generate_file_diff(const QuiltState &q, std::string_view patch,
@@ -5115,10 +6300,11 @@ static std::string generate_file_diff(const QuiltState &q, std::string_view patc
                                       DiffAlgorithm diff_algorithm = DiffAlgorithm::myers) {
     std::string backup_path = path_join(pc_patch_dir(q, patch), file);
     std::string working_path = path_join(q.work_dir, file);
-    return generate_path_diff(q, file, backup_path, true, working_path, false,
-                              p_format, reverse, diff_cmd_base,
-                              context_lines, diff_format, no_timestamps,
-                              diff_algorithm);
+    return path_diff_text(generate_path_diff(q, file, backup_path, true,
+                                             working_path, false, p_format,
+                                             reverse, diff_cmd_base,
+                                             context_lines, diff_format,
+                                             no_timestamps, diff_algorithm));
 }
 
 static std::map<std::string, std::string> split_patch_by_file(std::string_view content) {
@@ -5267,31 +6453,63 @@ int cmd_snapshot(QuiltState &q, int argc, char **argv) {
     }
 
     std::string snap_dir = pc_patch_dir(q, SNAPSHOT_PATCH);
-    if (is_directory(snap_dir) && !delete_dir_recursive(snap_dir)) {
-        err_line("Failed to remove " + snap_dir);
-        return 1;
-    }
-
     if (remove_snapshot) {
+        if (is_directory(snap_dir) && !delete_dir_recursive(snap_dir)) {
+            err_line("Failed to remove " + snap_dir);
+            return 1;
+        }
         return 0;
     }
 
     if (!ensure_pc_dir(q)) {
         return 1;
     }
-    if (!make_dirs(snap_dir)) {
+    if (!is_directory(snap_dir) && !make_dirs(snap_dir)) {
         err_line("Failed to create " + snap_dir);
         return 1;
     }
 
+    // Update an existing snapshot in place.  A copy is still current when
+    // its stamp matches the working file and predates the previous
+    // snapshot's .timestamp; anything written in the same clock tick as
+    // that snapshot is copied again.  The .timestamp is removed until the
+    // update completes, so an interrupted one starts over.
+    std::string timestamp = path_join(snap_dir, ".timestamp");
+    FileStamp taken;
+    bool have_taken = file_stamp(timestamp, taken);
+    if (have_taken && !delete_file(timestamp)) {
+        err_line("Failed to remove " + timestamp);
+        return 1;
+    }
+
+    auto old_files = files_in_patch(q, SNAPSHOT_PATCH);
+    std::set<std::string> stale(old_files.begin(), old_files.end());
     auto tracked = collect_files_for_patches(q, q.applied);
     for (const auto &file : tracked) {
+        bool present = stale.erase(file) > 0;
+        FileStamp src, dst;
+        if (present && have_taken &&
+            file_stamp(path_join(q.work_dir, file), src) &&
+            file_stamp(path_join(snap_dir, file), dst) &&
+            src == dst && src.write_time < taken.write_time) {
+            continue;
+        }
         if (!backup_file(q, SNAPSHOT_PATCH, file)) {
             err_line("Failed to snapshot " + file);
             return 1;
         }
     }
+    for (const auto &file : stale) {
+        if (!delete_file(path_join(snap_dir, file))) {
+            err_line("Failed to remove " + path_join(snap_dir, file));
+            return 1;
+        }
+    }
 
+    if (!write_file(timestamp, "")) {
+        err_line("Failed to create " + timestamp);
+        return 1;
+    }
     return 0;
 }
 
@@ -5490,6 +6708,91 @@ static std::string remove_diffstat_section(std::string_view header) {
 // Strip trailing whitespace from diff output lines.
 // Returns the cleaned diff and emits warnings to stderr.
 
+// Sorted line hashes of a file, for comparing contents as multisets.
+static std::vector<size_t> line_hashes(std::string_view content)
+{
+    std::vector<size_t> hashes;
+    for (std::string_view line : split_line_views(content)) {
+        hashes.push_back(std::hash<std::string_view>{}(line));
+    }
+    std::ranges::sort(hashes);
+    return hashes;
+}
+
+// Percentage of lines shared by two files, relative to the longer one.
+static int line_similarity(std::span<const size_t> a, std::span<const size_t> b)
+{
+    ptrdiff_t longest = std::max(std::ssize(a), std::ssize(b));
+    if (longest == 0) return 100;
+    ptrdiff_t common = 0;
+    for (size_t i = 0, j = 0; i < a.size() && j < b.size();) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else if (b[j] < a[i]) {
+            ++j;
+        } else {
+            ++common; ++i; ++j;
+        }
+    }
+    return checked_cast<int>(common * 100 / longest);
+}
+
+struct RenameSide {
+    std::string file;
+    std::string path;     // backup (deleted side) or working file (added side)
+    std::string content;
+    std::vector<size_t> hashes;
+};
+
+struct RenamePair {
+    RenameSide from;
+    RenameSide to;
+    int similarity;
+};
+
+// Pair files this patch deletes with files it creates when at least half
+// of their lines match, so refresh can record a rename plus the few edits
+// rather than a full delete and a full add.  Keyed by the new name.
+static std::map<std::string, RenamePair> find_renames(const QuiltState &q,
+                                                      std::string_view patch,
+                                                      std::span<const std::string> files)
+{
+    std::vector<RenameSide> deleted, added;
+    std::string pc_dir = pc_patch_dir(q, patch);
+    for (const auto &file : files) {
+        std::string backup = path_join(pc_dir, file);
+        std::string working = path_join(q.work_dir, file);
+        bool in_backup = file_exists(backup) && !is_placeholder_copy(backup);
+        bool in_tree = file_exists(working);
+        if (in_backup == in_tree) continue;
+
+        RenameSide side{file, in_backup ? backup : working, {}, {}};
+        side.content = read_file(side.path);
+        if (side.content.empty() || looks_binary(side.content)) continue;
+        side.hashes = line_hashes(side.content);
+        (in_backup ? deleted : added).push_back(std::move(side));
+    }
+
+    std::map<std::string, RenamePair> renames;
+    for (auto &to : added) {
+        ptrdiff_t best = -1;
+        int best_score = 49;
+        for (ptrdiff_t d = 0; d < std::ssize(deleted); ++d) {
+            int score = line_similarity(deleted[checked_cast<size_t>(d)].hashes, to.hashes);
+            if (score > best_score) {
+                best = d;
+                best_score = score;
+            }
+        }
+        if (best < 0) continue;
+        auto from = deleted.begin() + best;
+        std::string name = to.file;
+        renames.emplace(std::move(name), RenamePair{std::move(*from), std::move(to), best_score});
+        deleted.erase(from);
+    }
+    return renames;
+}
+
 int cmd_refresh(QuiltState &q, int argc, char **argv) {
     if (q.applied.empty()) {
         err_line("No patches applied");
@@ -5512,6 +6815,7 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
     bool opt_diffstat = false;
     bool opt_backup = false;
     bool opt_strip_whitespace = false;
+    bool opt_find_renames = false;
     DiffAlgorithm diff_algorithm = DiffAlgorithm::myers;
     {
         auto env_algo = get_env("QUILT_DIFF_ALGORITHM");
@@ -5616,6 +6920,11 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
             i += 1;
             continue;
         }
+        if (arg == "--find-renames") {
+            opt_find_renames = true;
+            i += 1;
+            continue;
+        }
         if (arg.starts_with("--diff-algorithm=")) {
             auto name = arg.substr(17);
             auto algo = parse_diff_algorithm(name);
@@ -5716,7 +7025,9 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
         make_dirs(new_pc);
 
         std::string orig_patch_path = path_join(q.work_dir, q.patches_dir, old_name);
-        std::string orig_patch_content = read_file(orig_patch_path);
+        auto orig_read = read_patch_file(orig_patch_path);
+        if (!orig_read) return 1;
+        std::string orig_patch_content = std::move(*orig_read);
         int orig_strip = q.get_strip_level(old_name);
         auto orig_files = files_in_patch(q, old_name);
 
@@ -5766,6 +7077,7 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
 
         // Insert new patch after original in series
         q.series.insert(q.series.begin() + *idx + 1, new_name);
+        q.reindex();
         std::string series_abs = path_join(q.work_dir, q.series_file);
         if (!write_series(series_abs, q.series, q.patch_strip_level, q.patch_reversed)) {
             err_line("Failed to write series file.");
@@ -5773,7 +7085,7 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
         }
 
         // Update applied: add fork after original
-        q.applied.push_back(new_name);
+        q.push_applied(new_name);
         std::string applied_path = path_join(q.work_dir, q.pc_dir, "applied-patches");
         write_applied(applied_path, q.applied);
 
@@ -5790,18 +7102,12 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
     std::set<std::string> shadowed;
     std::map<std::string, std::string> shadow_next_patch;
     if (patch != q.applied.back()) {
-        bool above = false;
-        for (const auto &a : q.applied) {
-            if (above) {
-                auto above_files = files_in_patch(q, a);
-                for (const auto &f : above_files) {
-                    if (!shadowed.contains(f)) {
-                        shadow_next_patch[f] = a;
-                    }
-                    shadowed.insert(f);
-                }
-            }
-            if (a == patch) above = true;
+        ptrdiff_t pos = q.find_in_applied(patch).value_or(std::ssize(q.applied));
+        for (const auto &[f, stack] : applied_files_index(q)) {
+            auto above = std::ranges::upper_bound(stack, pos);
+            if (above == stack.end()) continue;
+            shadowed.insert(f);
+            shadow_next_patch[f] = q.applied[checked_cast<size_t>(*above)];
         }
     }
 
@@ -5822,8 +7128,10 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
     std::string old_content;
     std::string header;
     if (file_exists(patch_file)) {
-        old_content = read_file(patch_file);
-        header = read_patch_header(patch_file);
+        auto read = read_patch_file(patch_file);
+        if (!read) return 1;
+        old_content = std::move(*read);
+        header = patch_header(old_content);
     }
 
     // Backup old patch file if requested
@@ -5831,21 +7139,56 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
         copy_file(patch_file, patch_file + "~");
     }
 
+    // Shadowed files are diffed against later backups, so only the rest
+    // can take part in rename detection
+    std::map<std::string, RenamePair> renames;
+    std::set<std::string> renamed_from;
+    if (opt_find_renames) {
+        std::vector<std::string> candidates;
+        for (const auto &file : tracked) {
+            if (!shadowed.contains(file)) candidates.push_back(file);
+        }
+        renames = find_renames(q, patch, candidates);
+        for (const auto &[to, pair] : renames) renamed_from.insert(pair.from.file);
+    }
+
     // Generate diffs
     std::string work_base = basename(q.work_dir);
     std::string patch_content = header;
 
     for (const auto &file : tracked) {
+        if (renamed_from.contains(file)) continue;
+        if (auto it = renames.find(file); it != renames.end()) {
+            const auto &[from, to, similarity] = it->second;
+            if (!no_index) {
+                std::string idx_name;
+                if (p_format == "0") idx_name = file;
+                else if (p_format == "ab") idx_name = "b/" + file;
+                else idx_name = work_base + "/" + file;
+                patch_content += "Index: " + idx_name + "\n";
+                patch_content += "===================================================================\n";
+            }
+            patch_content += generate_rename_diff(q, from.file, from.path, from.content,
+                                                  to.file, to.path, to.content,
+                                                  similarity, p_format, ctx_lines,
+                                                  diff_format, no_timestamps,
+                                                  diff_algorithm);
+            continue;
+        }
         if (shadowed.contains(file)) {
             // Diff this patch's backup against the next patch's backup
             auto it = shadow_next_patch.find(file);
             if (it != shadow_next_patch.end()) {
                 std::string this_backup = path_join(pc_patch_dir(q, patch), file);
                 std::string next_backup = path_join(pc_patch_dir(q, it->second), file);
-                std::string diff_out = generate_path_diff(q, file,
+                std::string diff_out = path_diff_text(generate_path_diff(q, file,
                     this_backup, true, next_backup, true,
                     p_format, false, {}, ctx_lines, diff_format, no_timestamps,
-                    diff_algorithm);
+                    diff_algorithm));
+                if (diff_out.starts_with("Binary files ")) {
+                    diff_out = generate_binary_diff(q, file, this_backup,
+                                                    next_backup, true, p_format);
+                }
                 if (!diff_out.empty()) {
                     if (!no_index) {
                         std::string idx_name;
@@ -5954,8 +7297,10 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
                                                    diff_format, no_timestamps,
                                                    diff_algorithm);
         if (diff_out.starts_with("Binary files ")) {
-            err("Diff failed on file '"); err(file); err_line("', aborting");
-            return 1;
+            diff_out = generate_binary_diff(q, file,
+                                            path_join(pc_patch_dir(q, patch), file),
+                                            path_join(q.work_dir, file), false,
+                                            p_format);
         }
         if (!diff_out.empty()) {
             if (!no_index) {
@@ -6026,7 +7371,7 @@ int cmd_refresh(QuiltState &q, int argc, char **argv) {
     }
 
     // Write the patch file
-    if (!write_file(patch_file, patch_content)) {
+    if (!write_patch_file(patch_file, patch_content)) {
         err_line("Failed to write patch file " + patch_file);
         return 1;
     }
@@ -6329,6 +7674,55 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
 
     std::string work_base = basename(q.work_dir);
 
+    // Per-file diffs go through a queue.  With an external diff utility it
+    // is flushed in batches whose commands run concurrently; built-in diffs
+    // are emitted at once.  Either way the output keeps the file order.
+    struct QueuedDiff {
+        std::string file;
+        PathDiff    diff;
+        bool        need_difference = false;  // keep output only on status 1
+        bool        warn_shadowed = false;
+    };
+    std::vector<QueuedDiff> queued;
+    auto flush_diffs = [&]() {
+        std::vector<std::vector<std::string>> cmds;
+        for (const auto &qd : queued) {
+            if (!qd.diff.cmd.empty()) cmds.push_back(qd.diff.cmd);
+        }
+        auto results = run_cmds(cmds, cpu_count());
+        auto result = results.begin();
+        for (auto &qd : queued) {
+            if (qd.warn_shadowed) {
+                err("Warning: more recent patches modify files in patch ");
+                err_line(patch_path_display(q, patch));
+            }
+            std::string diff_out = std::move(qd.diff.output);
+            if (!qd.diff.cmd.empty()) {
+                ProcessResult &r = *result++;
+                if (!qd.need_difference) {
+                    diff_out = external_diff_output(r);
+                } else if (r.exit_code == 1) {
+                    diff_out = std::move(r.out);
+                }
+            }
+            if (!diff_out.empty()) {
+                if (!no_index) {
+                    const std::string &file = qd.file;
+                    out("Index: " + (p_format == "0" ? file : p_format == "ab" ? "b/" + file : work_base + "/" + file) + "\n");
+                    out("===================================================================\n");
+                }
+                emit_diff(diff_out);
+            }
+        }
+        queued.clear();
+    };
+    auto queue_diff = [&](QueuedDiff qd) {
+        queued.push_back(std::move(qd));
+        if (diff_cmd_base.empty() || std::ssize(queued) >= 256) {
+            flush_diffs();
+        }
+    };
+
     if (since_refresh) {
         // diff -z: show changes since last refresh.
         // For each tracked file, reconstruct the "refreshed state" by applying
@@ -6337,7 +7731,7 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
         std::string stored_content;
         std::map<std::string, std::string> stored_sections;
         if (file_exists(patch_file)) {
-            stored_content = read_file(patch_file);
+            stored_content = read_patch_file(patch_file).value_or("");
             stored_sections = split_patch_by_file(stored_content);
         }
 
@@ -6419,7 +7813,7 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
                 std::swap(old_f, new_f);
             }
 
-            std::string diff_out;
+            QueuedDiff qd{file, {}};
             if (diff_cmd_base.empty()) {
                 // Use built-in diff
                 int ctx = ctx_lines;
@@ -6430,9 +7824,10 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
                 DiffResult dr = builtin_diff(old_f, new_f, ctx,
                                              old_label, new_label, diff_format,
                                              diff_algorithm);
-                diff_out = std::move(dr.output);
+                qd.diff.output = std::move(dr.output);
             } else {
-                std::vector<std::string> diff_cmd = diff_cmd_base;
+                std::vector<std::string> &diff_cmd = qd.diff.cmd;
+                diff_cmd = diff_cmd_base;
                 auto extra_diff_opts = shell_split(get_env("QUILT_DIFF_OPTS"));
                 for (const auto &opt : extra_diff_opts) diff_cmd.push_back(opt);
                 diff_cmd.push_back("--label");
@@ -6441,21 +7836,13 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
                 diff_cmd.push_back(new_label);
                 diff_cmd.push_back(old_f);
                 diff_cmd.push_back(new_f);
-
-                ProcessResult result = run_cmd(diff_cmd);
-                if (result.exit_code == 1) {
-                    diff_out = std::move(result.out);
-                }
-            }
-            if (!diff_out.empty()) {
-                if (!no_index) {
-                    out("Index: " + (p_format == "0" ? file : p_format == "ab" ? "b/" + file : work_base + "/" + file) + "\n");
-                    out("===================================================================\n");
-                }
-                emit_diff(diff_out);
+                qd.need_difference = true;
             }
+            queue_diff(std::move(qd));
         }
 
+        // The queued commands still read the reconstructed files
+        flush_diffs();
         delete_dir_recursive(tmp_dir);
     } else if (against_snapshot) {
         for (const auto &file : tracked) {
@@ -6477,17 +7864,10 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
                 new_placeholder = true;
             }
 
-            std::string diff_out = generate_path_diff(
+            queue_diff({file, generate_path_diff(
                 q, file, old_path, old_placeholder, new_path, new_placeholder,
                 p_format, reverse, diff_cmd_base, ctx_lines, diff_format,
-                no_timestamps, diff_algorithm);
-            if (!diff_out.empty()) {
-                if (!no_index) {
-                    out("Index: " + (p_format == "0" ? file : p_format == "ab" ? "b/" + file : work_base + "/" + file) + "\n");
-                    out("===================================================================\n");
-                }
-                emit_diff(diff_out);
-            }
+                no_timestamps, diff_algorithm)});
         }
     } else if (!combine_start.empty()) {
         // --combine: diff backup from the earliest patch in range against working file
@@ -6519,26 +7899,19 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
                 new_placeholder = true;
             }
 
-            std::string diff_out = generate_path_diff(
+            queue_diff({file, generate_path_diff(
                 q, file, old_path, true, new_path, new_placeholder,
                 p_format, reverse, diff_cmd_base, ctx_lines, diff_format,
-                no_timestamps, diff_algorithm);
-            if (!diff_out.empty()) {
-                if (!no_index) {
-                    out("Index: " + (p_format == "0" ? file : p_format == "ab" ? "b/" + file : work_base + "/" + file) + "\n");
-                    out("===================================================================\n");
-                }
-                emit_diff(diff_out);
-            }
+                no_timestamps, diff_algorithm)});
         }
     } else {
         // Warn if more recent patches modify files in this patch
         bool warned_shadowing = false;
         for (const auto &file : tracked) {
+            QueuedDiff qd{file, {}};
             std::string shadowing = next_patch_for_file(q, patch, file);
             if (!shadowing.empty() && !warned_shadowing) {
-                err("Warning: more recent patches modify files in patch ");
-                err_line(patch_path_display(q, patch));
+                qd.warn_shadowed = true;
                 warned_shadowing = true;
             }
 
@@ -6552,23 +7925,41 @@ int cmd_diff(QuiltState &q, int argc, char **argv) {
                 new_placeholder = true;
             }
 
-            std::string diff_out = generate_path_diff(
+            qd.diff = generate_path_diff(
                 q, file, old_path, true, new_path, new_placeholder,
                 p_format, reverse, diff_cmd_base, ctx_lines, diff_format,
                 no_timestamps, diff_algorithm);
-            if (!diff_out.empty()) {
-                if (!no_index) {
-                    out("Index: " + (p_format == "0" ? file : p_format == "ab" ? "b/" + file : work_base + "/" + file) + "\n");
-                    out("===================================================================\n");
-                }
-                emit_diff(diff_out);
-            }
+            queue_diff(std::move(qd));
         }
     }
+    flush_diffs();
 
     return 0;
 }
 
+// The content of file just before patch was applied, or nullopt if it did
+// not exist: the first backup of it from patch onward, where an empty one is
+// the placeholder for a missing file, else the working tree.
+static std::optional<std::string> pre_patch_content(const QuiltState &q,
+                                                    std::string_view patch,
+                                                    const std::string &file)
+{
+    bool reached = false;
+    for (const auto &ap : q.applied) {
+        if (ap == patch) reached = true;
+        if (!reached) continue;
+        std::string backup_path = path_join(pc_patch_dir(q, ap), file);
+        if (file_exists(backup_path)) {
+            std::string content = read_file(backup_path);
+            if (content.empty()) return std::nullopt;
+            return content;
+        }
+    }
+    std::string target = path_join(q.work_dir, file);
+    if (!file_exists(target)) return std::nullopt;
+    return read_file(target);
+}
+
 int cmd_revert(QuiltState &q, int argc, char **argv) {
     if (q.applied.empty()) {
         err_line("No patches applied");
@@ -6613,45 +8004,71 @@ int cmd_revert(QuiltState &q, int argc, char **argv) {
             continue;
         }
         // ap is a patch applied after 'patch'
-        auto later_files = files_in_patch(q, ap);
+        auto later = files_in_patch(q, ap);
+        std::set<std::string> later_files(later.begin(), later.end());
         for (const auto &file : files) {
-            for (const auto &lf : later_files) {
-                if (lf == file) {
-                    err("File "); err(file);
-                    err(" modified by patch ");
-                    err_line(patch_path_display(q, ap));
-                    return 1;
-                }
+            if (later_files.contains(file)) {
+                err("File "); err(file);
+                err(" modified by patch ");
+                err_line(patch_path_display(q, ap));
+                return 1;
             }
         }
     }
 
     // Read the patch file to apply its hunks to backup content
     std::string patch_file = path_join(q.work_dir, q.patches_dir, patch);
-    std::string patch_text = read_file(patch_file);
+    std::string patch_text = read_patch_file(patch_file).value_or("");
     int strip_level = q.patch_strip_level.count(std::string(patch))
         ? q.patch_strip_level.at(std::string(patch)) : 1;
 
-    for (const auto &file : files) {
-        // Check if file is tracked by the patch
-        std::string backup_path = path_join(pc_patch_dir(q, patch), file);
-        if (!file_exists(backup_path)) {
-            err("File "); err(file); err(" is not in patch ");
-            err_line(patch_path_display(q, patch));
-            return 1;
-        }
-
-        // Build the clean post-patch state by applying patch to backup
-        std::string backup_content = read_file(backup_path);
-        std::map<std::string, std::string> memfs;
-        memfs[file] = backup_content;
+    // Build the clean post-patch state of every requested file at once by
+    // applying the patch to their backups in memory, skipping the files
+    // nobody asked for.  Files up to the first one the patch does not
+    // track are reverted before reporting it.
+    std::string pc_dir = pc_patch_dir(q, patch);
+    std::set<std::string> wanted;
+    ptrdiff_t tracked_count = 0;
+    for (; tracked_count < std::ssize(files); ++tracked_count) {
+        const auto &file = files[checked_cast<size_t>(tracked_count)];
+        if (!file_exists(path_join(pc_dir, file))) break;
+        wanted.insert(file);
+    }
+
+    // A rename or copy reads one name and writes the other, so both sides
+    // of one touching a requested file take part.
+    std::set<std::string> load = wanted;
+    for (auto &[from, to] : git_renames(patch_text, strip_level)) {
+        if (wanted.contains(from) || wanted.contains(to)) {
+            load.insert(std::move(from));
+            load.insert(std::move(to));
+        }
+    }
+    std::map<std::string, std::string> memfs;
+    for (const auto &file : load) {
+        auto content = pre_patch_content(q, patch, file);
+        if (content) memfs[file] = std::move(*content);
+    }
+    if (!wanted.empty()) {
         PatchOptions opts;
         opts.strip_level = strip_level;
         opts.quiet = true;
         opts.fs = &memfs;
+        opts.only_files = &wanted;
         builtin_patch(patch_text, opts);
+    }
+
+    for (ptrdiff_t k = 0; k < std::ssize(files); ++k) {
+        const auto &file = files[checked_cast<size_t>(k)];
+        if (k == tracked_count) {
+            err("File "); err(file); err(" is not in patch ");
+            err_line(patch_path_display(q, patch));
+            return 1;
+        }
 
-        std::string clean_content = memfs.count(file) ? memfs[file] : "";
+        auto it = memfs.find(file);
+        std::string_view clean_content =
+            it != memfs.end() ? std::string_view(it->second) : std::string_view{};
 
         // Check if current file matches clean state (unchanged)
         std::string target = path_join(q.work_dir, file);
@@ -6714,54 +8131,91 @@ static bool write_applied_checked(const QuiltState &q,
 }
 
 
-static std::string extract_header(std::string_view content) {
-    std::string header;
-    auto lines = split_lines(content);
-    for (const auto &line : lines) {
+// Byte offset of the first line that starts the diff part of a patch
+// (everything before it is the header), or the content length if none.
+static ptrdiff_t find_diff_start(std::string_view content) {
+    ptrdiff_t pos = 0;
+    while (pos < std::ssize(content)) {
+        std::string_view line = content.substr(checked_cast<size_t>(pos));
         if (line.starts_with("Index:") ||
             line.starts_with("--- ") ||
             line.starts_with("diff ") ||
             line.starts_with("===")) {
-            break;
+            return pos;
         }
-        header += line;
-        header += '\n';
+        auto nl = str_find(content, '\n', pos);
+        if (nl < 0) break;
+        pos = nl + 1;
     }
-    return header;
+    return std::ssize(content);
 }
 
-static std::string replace_header(std::string_view content, std::string_view new_header) {
-    std::string result;
-    auto lines = split_lines(content);
-    bool in_diff = false;
-    // Find where diffs start
-    ptrdiff_t diff_start = 0;
-    for (ptrdiff_t i = 0; i < std::ssize(lines); ++i) {
-        if (lines[checked_cast<size_t>(i)].starts_with("Index:") ||
-            lines[checked_cast<size_t>(i)].starts_with("--- ") ||
-            lines[checked_cast<size_t>(i)].starts_with("diff ") ||
-            lines[checked_cast<size_t>(i)].starts_with("===")) {
-            diff_start = i;
-            in_diff = true;
-            break;
-        }
+// Append text to dst line by line, dropping CRs before line ends and
+// terminating the final line.
+static void append_lines(std::string &dst, std::string_view text) {
+    while (!text.empty()) {
+        auto nl = str_find(text, '\n');
+        std::string_view line = nl < 0 ? text : text.substr(0, checked_cast<size_t>(nl));
+        if (line.ends_with('\r')) line.remove_suffix(1);
+        dst += line;
+        dst += '\n';
+        if (nl < 0) break;
+        text.remove_prefix(checked_cast<size_t>(nl + 1));
     }
+}
+
+static std::string extract_header(std::string_view content) {
+    std::string header;
+    append_lines(header, content.substr(0, checked_cast<size_t>(find_diff_start(content))));
+    return header;
+}
 
-    result += std::string(new_header);
+static std::string replace_header(std::string_view content, std::string_view new_header) {
+    std::string result(new_header);
     // Ensure header ends with newline if non-empty
     if (!result.empty() && result.back() != '\n') {
         result += '\n';
     }
+    append_lines(result, content.substr(checked_cast<size_t>(find_diff_start(content))));
+    return result;
+}
 
-    if (in_diff) {
-        for (ptrdiff_t i = diff_start; i < std::ssize(lines); ++i) {
-            result += lines[checked_cast<size_t>(i)];
-            result += '\n';
-        }
+// Write content to path with its header replaced by new_header,
+// compressed as the name says.  The file is assembled in memory and
+// written in one call, so a failure cannot leave the new header without
+// its diff.  When the diff part needs no line-ending fixups it is
+// appended as a single block.
+static bool write_with_header(std::string_view path, std::string_view content,
+                              std::string_view new_header) {
+    std::string_view diff = content.substr(checked_cast<size_t>(find_diff_start(content)));
+    if (str_find(diff, '\r') >= 0 || (!diff.empty() && diff.back() != '\n')) {
+        return write_patch_file(path, replace_header(content, new_header));
     }
-    return result;
+    std::string result;
+    result.reserve(new_header.size() + 1 + diff.size());
+    result += new_header;
+    if (!result.empty() && result.back() != '\n') {
+        result += '\n';
+    }
+    result += diff;
+    return write_patch_file(path, result);
+}
+
+static std::string_view compression_suffix(std::string_view path) {
+    if (path.ends_with(".gz")) return ".gz";
+    if (path.ends_with(".zst")) return ".zst";
+    return {};
 }
 
+// Copy a patch into the patches directory.  The bytes are copied as they
+// are unless the two names call for different compression.
+static bool import_patch_file(const std::string &src, const std::string &dest) {
+    if (compression_suffix(src) == compression_suffix(dest)) {
+        return copy_file(src, dest);
+    }
+    auto text = read_patch_file(src);
+    return text && write_patch_file(dest, *text);
+}
 
 int cmd_delete(QuiltState &q, int argc, char **argv) {
     bool opt_remove = false;
@@ -6828,7 +8282,7 @@ int cmd_delete(QuiltState &q, int argc, char **argv) {
         }
         std::string pc_dir = pc_patch_dir(q, patch);
         if (is_directory(pc_dir)) delete_dir_recursive(pc_dir);
-        q.applied.pop_back();
+        q.pop_applied();
         if (!write_applied_checked(q, q.applied)) return 1;
         if (!q.applied.empty()) {
             out_line("Now at patch " +
@@ -6845,6 +8299,7 @@ int cmd_delete(QuiltState &q, int argc, char **argv) {
         return 1;
     }
     q.series = std::move(new_series);
+    q.reindex();
 
     // Optionally remove the patch file
     if (opt_remove) {
@@ -7013,6 +8468,7 @@ int cmd_rename(QuiltState &q, int argc, char **argv) {
     if (q.is_applied(old_patch)) {
         q.applied = std::move(new_applied);
     }
+    q.reindex();
 
     out("Patch "); out(patch_path_display(q, old_patch));
     out(" renamed to "); out_line(patch_path_display(q, new_name));
@@ -7105,11 +8561,16 @@ int cmd_import(QuiltState &q, int argc, char **argv) {
 
         // Copy patchfile to patches/<name>, handling -d header mode
         if (existing && force && dup_mode && dup_mode != 'n') {
-            // Merge headers based on -d mode
-            std::string old_content = read_file(dest);
-            std::string new_content = read_file(patchfile);
-            std::string old_hdr = extract_header(old_content);
-            std::string new_hdr = extract_header(new_content);
+            // Merge headers based on -d mode.  Only the old patch's header
+            // is kept, so its text is dropped as soon as that is extracted.
+            auto old_content = read_patch_file(dest);
+            auto new_content = read_patch_file(patchfile);
+            if (!old_content || !new_content) {
+                return 1;
+            }
+            std::string old_hdr = extract_header(*old_content);
+            old_content.reset();
+            std::string new_hdr = extract_header(*new_content);
             std::string merged_header;
             if (dup_mode == 'o') {
                 merged_header = old_hdr;
@@ -7120,17 +8581,19 @@ int cmd_import(QuiltState &q, int argc, char **argv) {
                 merged_header += "---\n";
                 merged_header += new_hdr;
             }
-            std::string result = replace_header(new_content, merged_header);
-            if (!write_file(dest, result)) {
+            if (!write_with_header(dest, *new_content, merged_header)) {
                 err_line("Failed to write " + dest);
                 return 1;
             }
         } else if (existing && force && !dup_mode) {
             // Both patches exist and no -d flag: check if both have headers
-            std::string old_content = read_file(dest);
-            std::string new_content = read_file(patchfile);
-            std::string old_hdr = extract_header(old_content);
-            std::string new_hdr = extract_header(new_content);
+            auto old_content = read_patch_file(dest);
+            auto new_content = read_patch_file(patchfile);
+            if (!old_content || !new_content) {
+                return 1;
+            }
+            std::string old_hdr = extract_header(*old_content);
+            std::string new_hdr = extract_header(*new_content);
             if (!old_hdr.empty() && !new_hdr.empty() && old_hdr != new_hdr) {
                 err_line("Patch headers differ:");
                 err_line("@@ -1 +1 @@");
@@ -7140,12 +8603,12 @@ int cmd_import(QuiltState &q, int argc, char **argv) {
                          "header(s) to keep.");
                 return 1;
             }
-            if (!copy_file(patchfile, dest)) {
+            if (!import_patch_file(patchfile, dest)) {
                 err_line("Failed to copy " + patchfile + " to " + dest);
                 return 1;
             }
         } else {
-            if (!copy_file(patchfile, dest)) {
+            if (!import_patch_file(patchfile, dest)) {
                 err_line("Failed to copy " + patchfile + " to " + dest);
                 return 1;
             }
@@ -7178,6 +8641,7 @@ int cmd_import(QuiltState &q, int argc, char **argv) {
                 return 1;
             }
             q.series = std::move(new_series);
+            q.reindex();
         } else {
             // Overwriting existing patch — rewrite series for metadata update
             if (!write_series_checked(q, q.series)) {
@@ -7331,7 +8795,9 @@ int cmd_header(QuiltState &q, int argc, char **argv) {
     }
 
     std::string patch_file = path_join(q.work_dir, q.patches_dir, patch);
-    std::string content = read_file(patch_file);
+    auto read = read_patch_file(patch_file);
+    if (!read) return 1;
+    std::string content = std::move(*read);
 
     // Helper to apply --strip-diffstat and --strip-trailing-whitespace
     auto apply_strip = [&](std::string h) {
@@ -7354,7 +8820,7 @@ int cmd_header(QuiltState &q, int argc, char **argv) {
             copy_file(patch_file, patch_file + "~");
         }
         std::string new_content = replace_header(content, new_header);
-        write_file(patch_file, new_content);
+        write_patch_file(patch_file, new_content);
         out_line("Appended text to header of patch " +
                  patch_path_display(q, patch));
         return 0;
@@ -7367,7 +8833,7 @@ int cmd_header(QuiltState &q, int argc, char **argv) {
             copy_file(patch_file, patch_file + "~");
         }
         std::string new_content = replace_header(content, new_header);
-        write_file(patch_file, new_content);
+        write_patch_file(patch_file, new_content);
         out_line("Replaced header of patch " +
                  patch_path_display(q, patch));
         return 0;
@@ -7399,7 +8865,7 @@ int cmd_header(QuiltState &q, int argc, char **argv) {
             copy_file(patch_file, patch_file + "~");
         }
         std::string new_content = replace_header(content, new_header);
-        write_file(patch_file, new_content);
+        write_patch_file(patch_file, new_content);
         out_line("Replaced header of patch " + patch_path_display(q, patch));
         return 0;
     }
@@ -7483,7 +8949,7 @@ int cmd_files(QuiltState &q, int argc, char **argv) {
                 file_list = files_in_patch(q, patch);
             } else {
                 std::string patch_file = path_join(q.work_dir, q.patches_dir, patch);
-                std::string content = read_file(patch_file);
+                std::string content = read_patch_file(patch_file).value_or("");
                 file_list = parse_patch_files(content);
             }
             std::ranges::sort(file_list);
@@ -7500,7 +8966,7 @@ int cmd_files(QuiltState &q, int argc, char **argv) {
                 file_list = files_in_patch(q, patch);
             } else {
                 std::string patch_file = path_join(q.work_dir, q.patches_dir, patch);
-                std::string content = read_file(patch_file);
+                std::string content = read_patch_file(patch_file).value_or("");
                 file_list = parse_patch_files(content);
             }
             for (auto &f : file_list) {
@@ -7549,10 +9015,11 @@ int cmd_patches(QuiltState &q, int argc, char **argv) {
         return 1;
     }
 
-    for (const auto &patch : q.series) {
+    for (ptrdiff_t idx = 0; idx < std::ssize(q.series); ++idx) {
+        const std::string &patch = q.series[checked_cast<size_t>(idx)];
         bool touches = false;
 
-        if (q.is_applied(patch)) {
+        if (q.is_applied_at(idx)) {
             // Check .pc/<patch>/<file>
             std::string pc_dir = pc_patch_dir(q, patch);
             for (const auto &tf : target_files) {
@@ -7565,7 +9032,7 @@ int cmd_patches(QuiltState &q, int argc, char **argv) {
         } else {
             // Parse patch file for references
             std::string patch_file = path_join(q.work_dir, q.patches_dir, patch);
-            std::string content = read_file(patch_file);
+            std::string content = read_patch_file(patch_file).value_or("");
             auto patched_files = parse_patch_files(content);
             for (const auto &tf : target_files) {
                 for (const auto &pf : patched_files) {
@@ -7584,7 +9051,7 @@ int cmd_patches(QuiltState &q, int argc, char **argv) {
                 // Show applied status: = for top, + for other applied, space for unapplied
                 if (!q.applied.empty() && patch == q.applied.back()) {
                     out_line("= " + display);
-                } else if (q.is_applied(patch)) {
+                } else if (q.is_applied_at(idx)) {
                     out_line("+ " + display);
                 } else {
                     out_line("  " + display);
@@ -7838,6 +9305,7 @@ int cmd_fork(QuiltState &q, int argc, char **argv) {
 
     q.series = std::move(new_series);
     q.applied = std::move(new_applied);
+    q.reindex();
 
     out_line("Fork of patch " + old_name +
              " created as " + new_name);
@@ -8302,14 +9770,13 @@ int cmd_graph(QuiltState &q, int argc, char **argv) {
 
     std::set<int> used_nodes;
     if (!selected_patch.empty()) {
-        auto selected = std::ranges::find_if(nodes,
-                                           [&](const GraphNode &node) {
-                                               return node.name == selected_patch;
-                                           });
-        if (selected == nodes.end()) {
+        // Nodes are numbered by position in applied
+        auto pos = q.find_in_applied(selected_patch);
+        if (!pos) {
             err("Patch "); err(selected_patch); err_line(" is not applied");
             return 1;
         }
+        auto selected = nodes.begin() + *pos;
 
         selected->attrs.push_back("style=bold");
         selected->attrs.push_back("color=grey");
@@ -8398,27 +9865,6 @@ int cmd_graph(QuiltState &q, int argc, char **argv) {
 
 
 
-static std::string extract_diff(std::string_view content) {
-    auto lines = split_lines(content);
-    std::string diff;
-    bool in_diff = false;
-    for (const auto &line : lines) {
-        if (!in_diff) {
-            if (line.starts_with("Index:") ||
-                line.starts_with("--- ") ||
-                line.starts_with("diff ") ||
-                line.starts_with("===")) {
-                in_diff = true;
-            }
-        }
-        if (in_diff) {
-            diff += line;
-            diff += '\n';
-        }
-    }
-    return diff;
-}
-
 static bool has_non_ascii(std::string_view s) {
     for (char ch : s) {
         if (static_cast<unsigned char>(ch) > 127) return true;
@@ -8640,12 +10086,18 @@ int cmd_mail(QuiltState &q, int argc, char **argv) {
     ptrdiff_t total = last_idx - first_idx + 1;
     int width = num_width(checked_cast<int>(total));
 
-    std::string mbox;
+    // Messages are appended to the mbox one at a time, so memory use is
+    // bounded by the largest patch rather than the whole series.
+    if (!write_file(mbox_file, "")) {
+        err_line("Failed to write mbox file: " + mbox_file);
+        return 1;
+    }
+    std::string msg;
 
     for (ptrdiff_t i = first_idx; i <= last_idx; ++i) {
         const std::string &patch = q.series[checked_cast<size_t>(i)];
         std::string patch_file = path_join(q.work_dir, q.patches_dir, patch);
-        std::string content = read_file(patch_file);
+        std::string content = read_patch_file(patch_file).value_or("");
 
         if (content.empty()) {
             err("Warning: patch ");
@@ -8654,9 +10106,10 @@ int cmd_mail(QuiltState &q, int argc, char **argv) {
             continue;
         }
 
-        // Extract header and diff
-        std::string header = extract_header(content);
-        std::string diff = extract_diff(content);
+        // Split into header and diff without copying either
+        auto diff_start = checked_cast<size_t>(find_diff_start(content));
+        std::string_view header = std::string_view(content).substr(0, diff_start);
+        std::string_view diff = std::string_view(content).substr(diff_start);
 
         // Split header into subject (first line) and body (rest)
         std::string subject_text;
@@ -8709,8 +10162,8 @@ int cmd_mail(QuiltState &q, int argc, char **argv) {
         }
         int seq = checked_cast<int>(i - first_idx + 1);
 
-        // Build message
-        std::string msg;
+        // Build message, reusing the buffer from the previous one
+        msg.clear();
 
         // Mbox separator
         msg += "From 0000000000000000000000000000000000000000 Mon Sep 17 00:00:00 2001\n";
@@ -8770,22 +10223,15 @@ int cmd_mail(QuiltState &q, int argc, char **argv) {
         }
 
         // Diff content
-        if (!diff.empty()) {
-            msg += diff;
-            if (diff.back() != '\n') {
-                msg += '\n';
-            }
-        }
+        append_lines(msg, diff);
 
         // Trailer (like git's "-- \n2.53.0\n")
         msg += "-- \nquilt\n\n";
 
-        mbox += msg;
-    }
-
-    if (!write_file(mbox_file, mbox)) {
-        err_line("Failed to write mbox file: " + mbox_file);
-        return 1;
+        if (!append_file(mbox_file, msg)) {
+            err_line("Failed to write mbox file: " + mbox_file);
+            return 1;
+        }
     }
 
     out("Wrote ");
@@ -8838,6 +10284,7 @@ int cmd_shell(QuiltState &, int, char **)    { return not_implemented("shell");
 #include <shellapi.h>
 
 #include <cctype>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
 
@@ -8896,10 +10343,9 @@ static bool write_handle(HANDLE h, const void *data, size_t len)
 // Write a UTF-8 string to a handle.  When the handle is a console,
 // convert to UTF-16 and use WriteConsoleW so that non-ASCII text
 // displays correctly.  For pipes/files, write raw UTF-8 bytes.
-static bool write_console_or_file(HANDLE h, std::string_view s)
+static bool write_console_or_file(HANDLE h, bool console, std::string_view s)
 {
-    DWORD mode;
-    if (GetConsoleMode(h, &mode)) {
+    if (console) {
         std::wstring wide = utf8_to_wide(s);
         const wchar_t *p = wide.data();
         DWORD remaining = checked_cast<DWORD>(std::ssize(wide));
@@ -8915,21 +10361,95 @@ static bool write_console_or_file(HANDLE h, std::string_view s)
     return write_handle(h, s.data(), s.size());
 }
 
-// Create an inheritable pipe.  read_end and write_end are set.
-// inherit_which: 0 = read end inheritable, 1 = write end inheritable
-static bool create_pipe(HANDLE &read_end, HANDLE &write_end,
-                        int inherit_which)
+// Buffered standard streams.  Redirected stdout accumulates and goes out
+// in large batches.  stdout on a console is flushed at the end of each
+// line so that long runs show progress, and stderr is written at once.
+// At most one stream holds pending text: writing to the other stream
+// flushes it first, which keeps stdout and stderr in the order they were
+// written.
+struct StdStream {
+    DWORD       std_handle;
+    bool        eager;
+    HANDLE      handle = INVALID_HANDLE_VALUE;
+    bool        console = false;
+    bool        resolved = false;
+    std::string buf;
+
+    StdStream(DWORD id, bool eager) : std_handle(id), eager(eager) {}
+};
+
+static StdStream std_out(STD_OUTPUT_HANDLE, false);
+static StdStream std_err(STD_ERROR_HANDLE, true);
+static constexpr ptrdiff_t STD_STREAM_BUFSIZE = 64 * 1024;
+
+static void resolve_stream(StdStream &s)
+{
+    if (!s.resolved) {
+        DWORD mode;
+        s.handle = GetStdHandle(s.std_handle);
+        s.console = s.handle != INVALID_HANDLE_VALUE && s.handle != nullptr &&
+                    GetConsoleMode(s.handle, &mode);
+        s.resolved = true;
+    }
+}
+
+static void flush_stream(StdStream &s)
+{
+    if (s.buf.empty()) return;
+    resolve_stream(s);
+    if (s.handle != INVALID_HANDLE_VALUE && s.handle != nullptr)
+        write_console_or_file(s.handle, s.console, s.buf);
+    s.buf.clear();
+}
+
+static void write_stream(StdStream &s, StdStream &other, std::string_view text)
+{
+    flush_stream(other);
+    s.buf += text;
+    resolve_stream(s);
+    if (s.eager || std::ssize(s.buf) >= STD_STREAM_BUFSIZE ||
+        (s.console && text.find('\n') != std::string_view::npos))
+        flush_stream(s);
+}
+
+// A failed assert() aborts without returning to main, so write out
+// whatever stdout still holds first.
+static void flush_on_abort(int)
 {
+    fd_flush();
+}
+
+// Create a pipe for one of a child's standard streams.  The parent's end
+// is a named pipe opened for overlapped I/O, which CreatePipe cannot
+// provide, so that the pipes of several children can be drained through
+// one completion port.  The child's end is an ordinary inheritable handle.
+// parent_reads: true for the child's stdout/stderr, false for its stdin.
+static bool create_async_pipe(HANDLE &parent_end, HANDLE &child_end,
+                              bool parent_reads)
+{
+    static DWORD serial;
+    std::wstring name = L"\\\\.\\pipe\\quilt-" +
+                        std::to_wstring(GetCurrentProcessId()) + L"-" +
+                        std::to_wstring(++serial);
+    DWORD access = parent_reads ? PIPE_ACCESS_INBOUND : PIPE_ACCESS_OUTBOUND;
+    parent_end = CreateNamedPipeW(name.c_str(),
+                                  access | FILE_FLAG_OVERLAPPED |
+                                  FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                  PIPE_TYPE_BYTE | PIPE_WAIT, 1,
+                                  4096, 4096, 0, nullptr);
+    if (parent_end == INVALID_HANDLE_VALUE) return false;
+
     SECURITY_ATTRIBUTES sa{};
     sa.nLength = sizeof(sa);
     sa.bInheritHandle = TRUE;
-
-    if (!CreatePipe(&read_end, &write_end, &sa, 0))
+    child_end = CreateFileW(name.c_str(),
+                            parent_reads ? GENERIC_WRITE : GENERIC_READ,
+                            0, &sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+    if (child_end == INVALID_HANDLE_VALUE) {
+        CloseHandle(parent_end);
         return false;
-
-    // Make the non-inherited end non-inheritable
-    HANDLE &non_inherit = (inherit_which == 0) ? write_end : read_end;
-    SetHandleInformation(non_inherit, HANDLE_FLAG_INHERIT, 0);
+    }
     return true;
 }
 
@@ -8982,117 +10502,251 @@ static std::wstring build_cmdline(const std::vector<std::string> &argv)
     return cmdline;
 }
 
-static ProcessResult run_cmd_impl(const std::vector<std::string> &argv,
-                                  const char *stdin_data, size_t stdin_len)
-{
-    ProcessResult result{};
+// Child processes run through a completion port.  Every pipe of every
+// running child has one overlapped read (or, for stdin, write) in flight,
+// so no child can block on a full pipe while another is being served, and
+// stdout, stderr and stdin of a single child make progress together.
+struct ChildSlot;
+
+// One of a running child's pipes.  The OVERLAPPED comes first so that a
+// completion packet leads straight back to its stream.
+struct ChildStream {
+    OVERLAPPED       ov{};
+    HANDLE           pipe = INVALID_HANDLE_VALUE;
+    ChildSlot       *slot = nullptr;
+    std::string     *sink = nullptr;  // read target; null for stdin
+    std::string_view input;           // stdin data not yet written
+    char             buf[4096];
+};
 
-    if (argv.empty()) {
-        result.exit_code = -1;
-        return result;
-    }
+struct ChildSlot {
+    ChildStream    streams[3];  // stdout, stderr, stdin
+    int            open = 0;    // streams not yet closed
+    HANDLE         process = nullptr;
+    ProcessResult *result = nullptr;
+};
 
-    // Create pipes for stdout, stderr, and optionally stdin
-    HANDLE stdout_rd = INVALID_HANDLE_VALUE, stdout_wr = INVALID_HANDLE_VALUE;
-    HANDLE stderr_rd = INVALID_HANDLE_VALUE, stderr_wr = INVALID_HANDLE_VALUE;
-    HANDLE stdin_rd  = INVALID_HANDLE_VALUE, stdin_wr  = INVALID_HANDLE_VALUE;
+struct CmdJob {
+    const std::vector<std::string> *argv;
+    const std::string_view         *input;  // null: inherit our stdin
+};
 
-    if (!create_pipe(stdout_rd, stdout_wr, 1)) {  // write end inheritable
-        result.exit_code = -1;
-        return result;
+static void close_stream(ChildStream &s)
+{
+    CloseHandle(s.pipe);
+    s.pipe = INVALID_HANDLE_VALUE;
+    --s.slot->open;
+}
+
+// Start the next overlapped transfer on a stream, or close the stream when
+// the pipe is finished.  A started transfer always ends in a completion
+// packet, even when it completes at once.
+static void pump_stream(ChildStream &s)
+{
+    s.ov = OVERLAPPED{};
+    BOOL ok;
+    if (s.sink) {
+        ok = ReadFile(s.pipe, s.buf, sizeof(s.buf), nullptr, &s.ov);
+    } else if (!s.input.empty()) {
+        DWORD len = static_cast<DWORD>(std::min<size_t>(s.input.size(), 1 << 16));
+        ok = WriteFile(s.pipe, s.input.data(), len, nullptr, &s.ov);
+    } else {
+        close_stream(s);  // all input written: signal EOF
+        return;
     }
-    if (!create_pipe(stderr_rd, stderr_wr, 1)) {
-        CloseHandle(stdout_rd); CloseHandle(stdout_wr);
-        result.exit_code = -1;
-        return result;
+    if (!ok && GetLastError() != ERROR_IO_PENDING) {
+        close_stream(s);  // normally ERROR_BROKEN_PIPE
     }
+}
 
-    bool need_stdin = (stdin_data != nullptr);
-    if (need_stdin) {
-        if (!create_pipe(stdin_rd, stdin_wr, 0)) {  // read end inheritable
-            CloseHandle(stdout_rd); CloseHandle(stdout_wr);
-            CloseHandle(stderr_rd); CloseHandle(stderr_wr);
-            result.exit_code = -1;
-            return result;
+static bool start_child(ChildSlot &slot, HANDLE port, const CmdJob &job,
+                        ProcessResult &result)
+{
+    slot.result = &result;
+    slot.open = 0;
+    int nstreams = job.input ? 3 : 2;
+    HANDLE child_ends[3] = {INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE,
+                            INVALID_HANDLE_VALUE};
+    bool ok = true;
+    for (int i = 0; ok && i < nstreams; ++i) {
+        ChildStream &s = slot.streams[i];
+        s.slot = &slot;
+        s.sink = i == 0 ? &result.out : i == 1 ? &result.err : nullptr;
+        s.input = i == 2 ? *job.input : std::string_view{};
+        ok = create_async_pipe(s.pipe, child_ends[i], i < 2);
+        if (!ok) {
+            s.pipe = INVALID_HANDLE_VALUE;
+            break;
         }
+        ++slot.open;
+        ok = CreateIoCompletionPort(s.pipe, port, 0, 0) != nullptr;
     }
 
-    STARTUPINFOW si{};
-    si.cb = sizeof(si);
-    si.dwFlags = STARTF_USESTDHANDLES;
-    si.hStdOutput = stdout_wr;
-    si.hStdError  = stderr_wr;
-    si.hStdInput  = need_stdin ? stdin_rd : GetStdHandle(STD_INPUT_HANDLE);
-
     PROCESS_INFORMATION pi{};
-
-    std::wstring cmdline = build_cmdline(argv);
-
-    BOOL ok = CreateProcessW(
-        nullptr,                               // lpApplicationName
-        cmdline.data(),                        // lpCommandLine (mutable)
-        nullptr, nullptr,                      // process/thread security
-        TRUE,                                  // inherit handles
-        CREATE_NO_WINDOW,                      // creation flags
-        nullptr,                               // environment
-        nullptr,                               // current directory
-        &si, &pi
-    );
+    DWORD error = 0;
+    if (ok) {
+        STARTUPINFOW si{};
+        si.cb = sizeof(si);
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdOutput = child_ends[0];
+        si.hStdError  = child_ends[1];
+        si.hStdInput  = job.input ? child_ends[2] : GetStdHandle(STD_INPUT_HANDLE);
+
+        std::wstring cmdline = build_cmdline(*job.argv);
+        ok = CreateProcessW(
+            nullptr,                               // lpApplicationName
+            cmdline.data(),                        // lpCommandLine (mutable)
+            nullptr, nullptr,                      // process/thread security
+            TRUE,                                  // inherit handles
+            CREATE_NO_WINDOW,                      // creation flags
+            nullptr,                               // environment
+            nullptr,                               // current directory
+            &si, &pi
+        ) != 0;
+        if (!ok) error = GetLastError();
+    }
 
     // Close child-side handles in parent
-    CloseHandle(stdout_wr);
-    CloseHandle(stderr_wr);
-    if (need_stdin) CloseHandle(stdin_rd);
+    for (HANDLE h : child_ends) {
+        if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+    }
 
     if (!ok) {
+        for (int i = 0; i < nstreams; ++i) {
+            if (slot.streams[i].pipe != INVALID_HANDLE_VALUE)
+                close_stream(slot.streams[i]);
+        }
         result.exit_code = -1;
-        result.err = "CreateProcessW failed: " + std::to_string(GetLastError());
-        CloseHandle(stdout_rd);
-        CloseHandle(stderr_rd);
-        if (need_stdin) CloseHandle(stdin_wr);
-        return result;
+        if (error) result.err = "CreateProcessW failed: " + std::to_string(error);
+        return false;
     }
 
-    // Write stdin data
-    if (need_stdin) {
-        write_handle(stdin_wr, stdin_data, stdin_len);
-        CloseHandle(stdin_wr);
+    CloseHandle(pi.hThread);
+    slot.process = pi.hProcess;
+    for (int i = 0; i < nstreams; ++i) {
+        pump_stream(slot.streams[i]);
     }
+    return true;
+}
 
-    // Read stdout and stderr
-    result.out = read_handle(stdout_rd);
-    result.err = read_handle(stderr_rd);
-    CloseHandle(stdout_rd);
-    CloseHandle(stderr_rd);
+static void finish_child(ChildSlot &slot)
+{
+    WaitForSingleObject(slot.process, INFINITE);
+    DWORD exit_code = 0;
+    GetExitCodeProcess(slot.process, &exit_code);
+    slot.result->exit_code = static_cast<int>(exit_code);
+    CloseHandle(slot.process);
+    slot.process = nullptr;
+}
 
-    // Wait for process
-    WaitForSingleObject(pi.hProcess, INFINITE);
+static void run_jobs(std::span<const CmdJob> jobs, std::span<ProcessResult> results,
+                     int max_jobs)
+{
+    fd_flush();
 
-    DWORD exit_code = 0;
-    GetExitCodeProcess(pi.hProcess, &exit_code);
-    result.exit_code = static_cast<int>(exit_code);
+    HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (!port) {
+        for (auto &r : results) r.exit_code = -1;
+        return;
+    }
 
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
+    // Each slot is a fixed address that its pending transfers point into
+    std::vector<ChildSlot> slots(checked_cast<size_t>(std::clamp(max_jobs, 1, 64)));
+    std::vector<ChildSlot *> idle;
+    for (auto &slot : slots) idle.push_back(&slot);
+
+    ptrdiff_t next = 0;
+    ptrdiff_t running = 0;
+    while (next < std::ssize(jobs) || running > 0) {
+        while (next < std::ssize(jobs) && !idle.empty()) {
+            const CmdJob &job = jobs[checked_cast<size_t>(next)];
+            ProcessResult &result = results[checked_cast<size_t>(next)];
+            ++next;
+            result = ProcessResult{};
+            if (job.argv->empty()) {
+                result.exit_code = -1;
+                continue;
+            }
+            ChildSlot *slot = idle.back();
+            if (!start_child(*slot, port, job, result)) continue;
+            if (slot->open == 0) {
+                finish_child(*slot);
+                continue;
+            }
+            idle.pop_back();
+            ++running;
+        }
+        if (running == 0) continue;
 
-    return result;
+        DWORD len = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *ov = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(port, &len, &key, &ov, INFINITE);
+        if (!ov) break;  // the port itself failed
+
+        auto &s = *reinterpret_cast<ChildStream *>(ov);
+        if (!ok) {
+            close_stream(s);  // the child closed its end
+        } else {
+            if (s.sink) {
+                s.sink->append(s.buf, len);
+            } else {
+                s.input.remove_prefix(len);
+            }
+            pump_stream(s);
+        }
+        if (s.slot->open == 0) {
+            finish_child(*s.slot);
+            idle.push_back(s.slot);
+            --running;
+        }
+    }
+
+    CloseHandle(port);
 }
 
 ProcessResult run_cmd(const std::vector<std::string> &argv)
 {
-    return run_cmd_impl(argv, nullptr, 0);
+    ProcessResult result{};
+    CmdJob job{&argv, nullptr};
+    run_jobs({&job, 1}, {&result, 1}, 1);
+    return result;
 }
 
 ProcessResult run_cmd_input(const std::vector<std::string> &argv,
                             std::string_view stdin_data)
 {
-    return run_cmd_impl(argv, stdin_data.data(), stdin_data.size());
+    ProcessResult result{};
+    CmdJob job{&argv, &stdin_data};
+    run_jobs({&job, 1}, {&result, 1}, 1);
+    return result;
+}
+
+std::vector<ProcessResult> run_cmds(std::span<const std::vector<std::string>> argvs,
+                                    int max_jobs)
+{
+    std::vector<ProcessResult> results(argvs.size());
+    if (argvs.empty()) return results;
+
+    std::vector<CmdJob> jobs;
+    for (const auto &argv : argvs) jobs.push_back({&argv, nullptr});
+    run_jobs(jobs, results, max_jobs);
+    return results;
+}
+
+int cpu_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return std::max(1, static_cast<int>(info.dwNumberOfProcessors));
 }
 
 int run_cmd_tty(const std::vector<std::string> &argv)
 {
     if (argv.empty()) return -1;
 
+    fd_flush();
+
     STARTUPINFOW si{};
     si.cb = sizeof(si);
     // No STARTF_USESTDHANDLES — child inherits console
@@ -9291,6 +10945,21 @@ int64_t file_mtime(std::string_view path)
     return static_cast<int64_t>((ft - 116444736000000000ULL) / 10000000ULL);
 }
 
+bool file_stamp(std::string_view path, FileStamp &stamp)
+{
+    std::wstring wpath = utf8_to_wide(path);
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(wpath.c_str(), GetFileExInfoStandard, &data) ||
+        (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return false;
+    stamp.size = static_cast<int64_t>(
+        (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow);
+    stamp.write_time = static_cast<int64_t>(
+        (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32)
+        | data.ftLastWriteTime.dwLowDateTime);
+    return true;
+}
+
 std::vector<DirEntry> list_dir(std::string_view path)
 {
     std::vector<DirEntry> entries;
@@ -9451,16 +11120,18 @@ bool set_cwd(std::string_view path)
 
 void fd_write_stdout(std::string_view s)
 {
-    HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (h != INVALID_HANDLE_VALUE)
-        write_console_or_file(h, s);
+    write_stream(std_out, std_err, s);
 }
 
 void fd_write_stderr(std::string_view s)
 {
-    HANDLE h = GetStdHandle(STD_ERROR_HANDLE);
-    if (h != INVALID_HANDLE_VALUE)
-        write_console_or_file(h, s);
+    write_stream(std_err, std_out, s);
+}
+
+void fd_flush()
+{
+    flush_stream(std_out);
+    flush_stream(std_err);
 }
 
 bool stdout_is_tty()
@@ -9471,6 +11142,7 @@ bool stdout_is_tty()
 
 std::string read_stdin()
 {
+    fd_flush();
     HANDLE h = GetStdHandle(STD_INPUT_HANDLE);
     if (h == INVALID_HANDLE_VALUE) return {};
     return read_handle(h);
@@ -9510,6 +11182,8 @@ DateTime local_time(int64_t timestamp)
 
 int main(int, char **)
 {
+    std::signal(SIGABRT, flush_on_abort);
+
     // Use GetCommandLineW + CommandLineToArgvW for reliable parsing
     int argc = 0;
     wchar_t **wargv = CommandLineToArgvW(GetCommandLineW(), &argc);
@@ -9528,7 +11202,9 @@ int main(int, char **)
         argv_ptrs.push_back(a.data());
     argv_ptrs.push_back(nullptr);
 
-    return quilt_main(argc, argv_ptrs.data());
+    int rc = quilt_main(argc, argv_ptrs.data());
+    fd_flush();
+    return rc;
 }
 
 